@@ -51,6 +51,39 @@ echo "Creating state directory..."
 mkdir -p /var/lib/omen-rgb-keyboard
 chmod 755 /var/lib/omen-rgb-keyboard
 
+# Install state save/restore script and systemd services
+echo "Installing state persistence services..."
+cp scripts/omen-rgb-state.sh /usr/local/bin/omen-rgb-state
+chmod +x /usr/local/bin/omen-rgb-state
+
+# Pulled in by the udev rules when the device appears; saves again on stop
+cat > /etc/systemd/system/omen-rgb-state.service << 'EOF'
+[Unit]
+Description=HP OMEN RGB Keyboard state restore
+BindsTo=sys-devices-platform-omen\x2drgb\x2dkeyboard.device
+After=sys-devices-platform-omen\x2drgb\x2dkeyboard.device
+RequiresMountsFor=/var/lib/omen-rgb-keyboard
+
+[Service]
+Type=oneshot
+RemainAfterExit=yes
+ExecStart=/usr/local/bin/omen-rgb-state restore
+ExecStop=/usr/local/bin/omen-rgb-state save
+EOF
+
+# Started by the udev rules on each state change uevent
+cat > /etc/systemd/system/omen-rgb-state-save.service << 'EOF'
+[Unit]
+Description=HP OMEN RGB Keyboard state save
+RequiresMountsFor=/var/lib/omen-rgb-keyboard
+
+[Service]
+Type=oneshot
+ExecStart=/usr/local/bin/omen-rgb-state save
+EOF
+systemctl daemon-reload 2>/dev/null || true
+echo "  State is saved to /var/lib/omen-rgb-keyboard/state by omen-rgb-state.service"
+
 # Load the module immediately
 echo "Loading module..."
 modprobe omen_rgb_keyboard
@@ -155,6 +188,9 @@ else
     echo "  The mute monitor service requires udev rules to work properly"
 fi
 
+# The device was bound before the rules existed: restore the saved state now
+systemctl start omen-rgb-state.service 2>/dev/null || true
+
 echo ""
 echo "Installation complete!"
 echo "The driver will now load automatically on boot."
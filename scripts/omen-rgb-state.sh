@@ -0,0 +1,37 @@
+#!/bin/bash
+# Save or restore the driver state blob (rgb_zones/state)
+SYSFS="/sys/devices/platform/omen-rgb-keyboard/rgb_zones/state"
+STATE_DIR="/var/lib/omen-rgb-keyboard"
+STATE_FILE="$STATE_DIR/state"
+
+case "$1" in
+save)
+	# The device may already be gone when stopping after an unload
+	[ -r "$SYSFS" ] || exit 0
+	mkdir -p "$STATE_DIR"
+	tmp=$(mktemp "$STATE_FILE.XXXXXX") || exit 1
+	if cat "$SYSFS" > "$tmp"; then
+		mv -f "$tmp" "$STATE_FILE"
+	else
+		rm -f "$tmp"
+		echo "omen-rgb-state: failed to read $SYSFS" >&2
+		exit 1
+	fi
+	;;
+restore)
+	[ -s "$STATE_FILE" ] || exit 0
+	# The device uevent comes before the driver has created rgb_zones
+	for _ in $(seq 50); do
+		[ -w "$SYSFS" ] && break
+		sleep 0.1
+	done
+	if ! cat "$STATE_FILE" > "$SYSFS"; then
+		echo "omen-rgb-state: $SYSFS rejected $STATE_FILE" >&2
+		exit 1
+	fi
+	;;
+*)
+	echo "usage: $0 save|restore" >&2
+	exit 2
+	;;
+esac
@@ -10,239 +10,264 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/kernel.h>
-#include <linux/timer.h>
+#include <linux/module.h>
+#include <linux/atomic.h>
+#include <linux/average.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 #include <linux/workqueue.h>
-#include <linux/jiffies.h>
 #include <linux/math.h>
+#include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
 
 #include "omen_rgb_keyboard.h"
 #include "omen_wmi.h"
 #include "omen_animations.h"
 #include "omen_zones.h"
 #include "omen_state.h"
-#include "../utils/math/sin_lut.h"
+#include "../utils/math/sin_q15.h"
+#include "../utils/math/color_fixed.h"
 
-/* Animation state */
-enum animation_mode current_animation = ANIMATION_STATIC;
-int animation_speed = ANIMATION_SPEED_DEFAULT;
-bool animation_active = false;
-struct gradient_config gradient_cfg;
-DEFINE_MUTEX(gradient_cfg_mutex);
+/*
+ * Render inputs. Writers hold render_state_mutex for the whole update,
+ * including any restart of the frame clock, and edit render_state; each
+ * write section ends by publishing it through a seqcount latch. Readers
+ * copy one of the two latch slots and never wait for, or take the lock
+ * of, a writer, so the writer may cancel the render work while holding
+ * render_state_mutex, also on PREEMPT_RT.
+ */
+static DEFINE_MUTEX(render_state_mutex);
+static seqcount_latch_t render_state_seq = SEQCNT_LATCH_ZERO(render_state_seq);
+static struct render_state render_state = {
+	.mode = ANIMATION_STATIC,
+	.speed = ANIMATION_SPEED_DEFAULT,
+	.brightness = 100,
+};
+static struct render_state render_state_latch[2] = {
+	[0 ... 1] = {
+		.mode = ANIMATION_STATIC,
+		.speed = ANIMATION_SPEED_DEFAULT,
+		.brightness = 100,
+	},
+};
 
-static struct timer_list animation_timer;
+/*
+ * Gradient config, published as an immutable RCU object so the render
+ * path reads it without locks or copies. gradient_cfg_mutex only
+ * serializes writers.
+ */
+struct gradient_group_steps {
+	u8 zone_mask;
+	u8 color_count;
+	struct color_platform from[GRADIENT_MAX_COLORS];
+	s16 delta[GRADIENT_MAX_COLORS][3];	/* next color - this one: r, g, b */
+};
+
+struct gradient_state {
+	struct rcu_head rcu;
+	struct gradient_config cfg;
+	struct gradient_group_steps steps[GRADIENT_MAX_GROUPS];
+};
+
+static struct gradient_state __rcu *gradient_state;
+static DEFINE_MUTEX(gradient_cfg_mutex);
+
+static bool render_highpri = true;
+module_param(render_highpri, bool, 0444);
+MODULE_PARM_DESC(render_highpri, "Render animation frames on a high priority workqueue");
+
+static bool adaptive_fps = true;
+module_param(adaptive_fps, bool, 0644);
+MODULE_PARM_DESC(adaptive_fps, "Lower the frame rate for slow effects, a slow BIOS or unchanging frames");
+
+static unsigned int keyframe_cache_kb = 16;
+module_param(keyframe_cache_kb, uint, 0644);
+MODULE_PARM_DESC(keyframe_cache_kb, "Memory budget for precomputed animation frames in KiB (0 = render every frame live)");
+
+/* Consecutive unchanged frames before the frame rate is halved */
+#define ANIMATION_IDLE_FRAMES 8
+
+/* Moving average of frame commit time in microseconds */
+DECLARE_EWMA(commit_latency, 4, 8)
+
+static int animation_fps = ANIMATION_FPS_DEFAULT;
+static u64 animation_period_ns = NSEC_PER_SEC / ANIMATION_FPS_DEFAULT;
+static int animation_fps_current = ANIMATION_FPS_DEFAULT;
+static const char *animation_fps_reason = "cap";
+static struct ewma_commit_latency animation_commit_latency;
+static unsigned int animation_idle_frames;
+static struct color_platform animation_last_frame[ZONE_COUNT];
+
+static struct hrtimer animation_timer;
+static struct workqueue_struct *animation_wq;
 static struct work_struct animation_work;
-static unsigned long animation_start_time;
+/* Stops the frame clock once a crossfade into a static frame has ended */
+static struct work_struct animation_settle_work;
+
+static unsigned int animation_transition_ms = ANIMATION_TRANSITION_MS_DEFAULT;
+static u64 animation_tick_ns;
+
+/* Another frame source owns the output; written under render_state_mutex */
+static bool animation_output_held;
+
+/* Set from the timer tick until the frame it queued has been committed */
+static atomic_t animation_render_busy = ATOMIC_INIT(0);
+
+static atomic64_t animation_frames_rendered = ATOMIC64_INIT(0);
+static atomic64_t animation_frames_dropped = ATOMIC64_INIT(0);
+static atomic64_t animation_frames_late = ATOMIC64_INIT(0);
+static atomic64_t animation_frames_cached = ATOMIC64_INIT(0);
 
 void hsv_to_rgb(int h, int s, int v, struct color_platform *rgb)
 {
-	int c = (v * s) / 100;
-	int x = c * (60 - abs((h % 120) - 60)) / 60;
-	int m = v - c;
-
-	int r, g, b;
-
-	if (h < 60) {
-		r = c; g = x; b = 0;
-	} else if (h < 120) {
-		r = x; g = c; b = 0;
-	} else if (h < 180) {
-		r = 0; g = c; b = x;
-	} else if (h < 240) {
-		r = 0; g = x; b = c;
-	} else if (h < 300) {
-		r = x; g = 0; b = c;
-	} else {
-		r = c; g = 0; b = x;
-	}
+	h %= 360;
+	if (h < 0)
+		h += 360;
 
-	rgb->red = (r + m) * 255 / 100;
-	rgb->green = (g + m) * 255 / 100;
-	rgb->blue = (b + m) * 255 / 100;
+	cf_hsv_to_rgb(cf_hue_from_deg(h), cf_pct_to_u8(clamp(s, 0, 100)),
+		      cf_pct_to_u8(clamp(v, 0, 100)),
+		      &rgb->red, &rgb->green, &rgb->blue);
 }
 
-/* Animation implementations */
-static void animation_breathing(void)
+/* Q16 level swinging between @lo and @hi (Q16) as (1 + sin) / 2 */
+static u32 animation_sin_level(u32 turn, u32 lo, u32 hi)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long cycle_time = msecs_to_jiffies(2000 / animation_speed); /* 2 second cycle */
-	unsigned long cycle_pos = elapsed % cycle_time;
+	u32 u = sin_q15(turn) + 32768;
 
-	int angle = (360 * cycle_pos) / cycle_time;
-	int intensity = 50 + (50 * lut_sin(angle)) / 100;
-
-	struct color_platform colors[ZONE_COUNT];
-	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		colors[zone] = original_colors[zone].colors;
-		colors[zone].red = (colors[zone].red * intensity) / 100;
-		colors[zone].green = (colors[zone].green * intensity) / 100;
-		colors[zone].blue = (colors[zone].blue * intensity) / 100;
-	}
+	return lo + (((hi - lo) * u) >> 16);
+}
 
-	update_all_zones_with_colors(colors);
+static void animation_scale(struct color_platform *c, u32 f)
+{
+	c->red = cf_scale8(c->red, f);
+	c->green = cf_scale8(c->green, f);
+	c->blue = cf_scale8(c->blue, f);
 }
 
-static void animation_rainbow(void)
+/*
+ * Effect renderers: fill one frame for position @pos (Q16 turn) within
+ * cycle number @cycle of the effect, from the user's zone colors @base.
+ * Only gradient looks at @cycle.
+ */
+static void animation_breathing(struct color_platform *colors,
+				const struct color_platform *base, u64 cycle, u32 pos)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long cycle_time = msecs_to_jiffies(3000 / animation_speed); /* 3 second cycle */
-	unsigned long cycle_pos = elapsed % cycle_time;
+	u32 level = animation_sin_level(pos, 0, CF_Q16_ONE);
 
-	struct color_platform colors[ZONE_COUNT];
 	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		int hue = (360 * cycle_pos / cycle_time + zone * 90) % 360;
-		hsv_to_rgb(hue, 100, 100, &colors[zone]);
+		colors[zone] = base[zone];
+		animation_scale(&colors[zone], level);
 	}
-
-	update_all_zones_with_colors(colors);
 }
 
-static void animation_wave(void)
+static void animation_rainbow(struct color_platform *colors,
+			      const struct color_platform *base, u64 cycle, u32 pos)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long cycle_time = msecs_to_jiffies(2000 / animation_speed); /* 2 second cycle */
-	unsigned long cycle_pos = elapsed % cycle_time;
+	u32 hue = (pos * CF_HUE_MAX) >> 16;
 
-	struct color_platform colors[ZONE_COUNT];
 	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		int wave_pos = (cycle_pos * 4 / cycle_time + zone) % 4;
-		int angle = (360 * wave_pos) / 4;
-		int intensity = 30 + (70 * (100 + lut_sin(angle)) / 200);
-
-		colors[zone] = original_colors[zone].colors;
-		colors[zone].red = (colors[zone].red * intensity) / 100;
-		colors[zone].green = (colors[zone].green * intensity) / 100;
-		colors[zone].blue = (colors[zone].blue * intensity) / 100;
+		cf_hsv_to_rgb(hue + zone * CF_HUE_MAX / 4, 255, 255,
+			      &colors[zone].red, &colors[zone].green,
+			      &colors[zone].blue);
 	}
-
-	update_all_zones_with_colors(colors);
 }
 
-static void animation_pulse(void)
+static void animation_wave(struct color_platform *colors,
+			   const struct color_platform *base, u64 cycle, u32 pos)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long cycle_time = msecs_to_jiffies(1500 / animation_speed); /* 1.5 second cycle */
-	unsigned long cycle_pos = elapsed % cycle_time;
+	for (int zone = 0; zone < ZONE_COUNT; zone++) {
+		/* Each zone steps through four quarter-turn levels */
+		u32 wave_pos = ((pos >> 14) + zone) & 3;
+
+		colors[zone] = base[zone];
+		animation_scale(&colors[zone],
+				animation_sin_level(wave_pos << 14, cf_pct_to_q16(30),
+						    CF_Q16_ONE));
+	}
+}
 
-	int angle = (360 * cycle_pos) / cycle_time;
-	int intensity = 20 + (80 * (100 + lut_sin(angle)) / 200);
+static void animation_pulse(struct color_platform *colors,
+			    const struct color_platform *base, u64 cycle, u32 pos)
+{
+	u32 level = animation_sin_level(pos, cf_pct_to_q16(20), CF_Q16_ONE);
 
-	struct color_platform colors[ZONE_COUNT];
 	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		colors[zone] = original_colors[zone].colors;
-		colors[zone].red = (colors[zone].red * intensity) / 100;
-		colors[zone].green = (colors[zone].green * intensity) / 100;
-		colors[zone].blue = (colors[zone].blue * intensity) / 100;
+		colors[zone] = base[zone];
+		animation_scale(&colors[zone], level);
 	}
-
-	update_all_zones_with_colors(colors);
 }
 
-static void animation_chase(void)
+static void animation_chase(struct color_platform *colors,
+			    const struct color_platform *base, u64 cycle, u32 pos)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long cycle_time = msecs_to_jiffies(1200 / animation_speed); /* 1.2 second cycle */
-	unsigned long cycle_pos = elapsed % cycle_time;
-
-	struct color_platform colors[ZONE_COUNT];
-	int active_zone = (cycle_pos * ZONE_COUNT) / cycle_time;
+	int active_zone = (pos * ZONE_COUNT) >> 16;
 
-	struct color_platform base_color = original_colors[0].colors;
+	struct color_platform base_color = base[0];
 
 	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		if (zone == active_zone) {
-			colors[zone] = base_color;
-		} else {
-			colors[zone] = base_color;
-			colors[zone].red = colors[zone].red / 6;
-			colors[zone].green = colors[zone].green / 6;
-			colors[zone].blue = colors[zone].blue / 6;
-		}
+		colors[zone] = base_color;
+		if (zone != active_zone)
+			animation_scale(&colors[zone], CF_Q16_ONE / 6);
 	}
-
-	update_all_zones_with_colors(colors);
 }
 
-static void animation_sparkle(void)
+static void animation_sparkle(struct color_platform *colors,
+			      const struct color_platform *base, u64 cycle, u32 pos)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long cycle_time = msecs_to_jiffies(3000 / animation_speed);
-
-	struct color_platform colors[ZONE_COUNT];
-	struct color_platform base_color = original_colors[0].colors;
+	struct color_platform base_color = base[0];
 
 	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		int sparkle_offset = (elapsed + zone * 800) % cycle_time;
-		int sparkle_duration = cycle_time / 8; /* Short sparkle duration */
+		/* Zones sparkle 800 ms apart in a 3 s cycle */
+		u32 sparkle_pos = (pos + zone * (CF_Q16_ONE * 800 / 3000)) & 0xffff;
 
-		if (sparkle_offset < sparkle_duration) {
+		/* Short sparkle: first eighth of the cycle */
+		if (sparkle_pos < CF_Q16_ONE / 8) {
 			colors[zone].red = 255;
 			colors[zone].green = 255;
 			colors[zone].blue = 255;
 		} else {
 			colors[zone] = base_color;
-			colors[zone].red = colors[zone].red / 8;
-			colors[zone].green = colors[zone].green / 8;
-			colors[zone].blue = colors[zone].blue / 8;
+			animation_scale(&colors[zone], CF_Q16_ONE / 8);
 		}
 	}
-
-	update_all_zones_with_colors(colors);
 }
 
-static void animation_candle(void)
+static void animation_candle(struct color_platform *colors,
+			     const struct color_platform *base, u64 cycle, u32 pos)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long cycle_time = msecs_to_jiffies(100 / animation_speed); /* Fast flicker */
-	unsigned long cycle_pos = elapsed % cycle_time;
-
-	struct color_platform colors[ZONE_COUNT];
+	/* Candle flicker - warm colors with a fast intensity ramp */
+	u32 level = cf_pct_to_q16(60) + ((cf_pct_to_q16(40) * pos) >> 16);
 
 	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		/* Candle flicker - warm colors with random intensity */
-		int flicker = (cycle_pos + zone * 500) % cycle_time;
-		int intensity = 60 + (40 * flicker) / cycle_time;
-
-		colors[zone].red = (255 * intensity) / 100;
-		colors[zone].green = (150 * intensity) / 100;
-		colors[zone].blue = (50 * intensity) / 100;
+		colors[zone].red = cf_scale8(255, level);
+		colors[zone].green = cf_scale8(150, level);
+		colors[zone].blue = cf_scale8(50, level);
 	}
-
-	update_all_zones_with_colors(colors);
 }
 
-static void animation_aurora(void)
+static void animation_aurora(struct color_platform *colors,
+			     const struct color_platform *base, u64 cycle, u32 pos)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long cycle_time = msecs_to_jiffies(4000 / animation_speed); /* Slow aurora */
-	unsigned long cycle_pos = elapsed % cycle_time;
-
-	struct color_platform colors[ZONE_COUNT];
-
 	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		int wave_pos = (cycle_pos * 2 + zone * 1000) % cycle_time;
-		int intensity = 30 + (70 * (100 + lut_sin((360 * wave_pos) / cycle_time)) / 200);
+		/* Two waves per cycle, zones a quarter turn apart */
+		u32 level = animation_sin_level(pos * 2 + zone * (CF_Q16_ONE / 4),
+						cf_pct_to_q16(30), CF_Q16_ONE);
 
 		/* Aurora colors - green and blue */
-		colors[zone].red = (20 * intensity) / 100;
-		colors[zone].green = (200 * intensity) / 100;
-		colors[zone].blue = (180 * intensity) / 100;
+		colors[zone].red = cf_scale8(20, level);
+		colors[zone].green = cf_scale8(200, level);
+		colors[zone].blue = cf_scale8(180, level);
 	}
-
-	update_all_zones_with_colors(colors);
 }
 
-static void animation_disco(void)
+static void animation_disco(struct color_platform *colors,
+			    const struct color_platform *base, u64 cycle, u32 pos)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long cycle_time = msecs_to_jiffies(300 / animation_speed); /* Fast strobe */
-	unsigned long cycle_pos = elapsed % cycle_time;
-
-	struct color_platform colors[ZONE_COUNT];
-
 	/* Disco strobe - bright colors that flash */
-	if (cycle_pos < cycle_time / 2) {
+	if (pos < CF_Q16_ONE / 2) {
 		/* Flash on */
 		for (int zone = 0; zone < ZONE_COUNT; zone++) {
 			/* Different bright colors for each zone */
@@ -261,206 +286,670 @@ static void animation_disco(void)
 			colors[zone].blue = 0;
 		}
 	}
-
-	update_all_zones_with_colors(colors);
 }
 
-static void animation_gradient(void)
+/* One effect cycle is one color transition; @cycle selects the pair */
+static void animation_gradient(struct color_platform *colors,
+			       const struct color_platform *base, u64 cycle, u32 pos)
 {
-	unsigned long elapsed = jiffies - animation_start_time;
-	unsigned long step_time = msecs_to_jiffies(3000 / animation_speed);
-	struct color_platform colors[ZONE_COUNT];
-	struct gradient_config cfg_snapshot;
+	const struct gradient_state *gs;
 	int g, z;
 
-	/* Take a snapshot of the config under the lock */
-	mutex_lock(&gradient_cfg_mutex);
-	cfg_snapshot = gradient_cfg;
-	mutex_unlock(&gradient_cfg_mutex);
-
 	/* Start with current zone colors as fallback for ungrouped zones */
 	for (z = 0; z < ZONE_COUNT; z++)
-		colors[z] = original_colors[z].colors;
+		colors[z] = base[z];
 
-	for (g = 0; g < cfg_snapshot.group_count; g++) {
-		struct gradient_group *grp = &cfg_snapshot.groups[g];
-		unsigned long total_cycle, cycle_pos, frac;
-		int idx_a, idx_b;
+	rcu_read_lock();
+	gs = rcu_dereference(gradient_state);
+	for (g = 0; gs && g < gs->cfg.group_count; g++) {
+		const struct gradient_group_steps *st = &gs->steps[g];
 		struct color_platform interpolated;
+		u32 idx;
 
-		if (grp->color_count == 0)
+		if (st->color_count == 0)
 			continue;
 
-		/* Total cycle = time per color transition * number of colors */
-		total_cycle = step_time * grp->color_count;
-		cycle_pos = elapsed % total_cycle;
+		/* Transition from color idx to idx + 1 */
+		div_u64_rem(cycle, st->color_count, &idx);
 
-		/* Which two colors are we interpolating between? */
-		idx_a = cycle_pos / step_time;
-		idx_b = (idx_a + 1) % grp->color_count;
-
-		/* Fractional position between color A and B (0 to step_time) */
-		frac = cycle_pos - (idx_a * step_time);
-
-		/* Linear interpolation using integer math */
-		interpolated.red   = grp->colors[idx_a].red   + (int)(grp->colors[idx_b].red   - grp->colors[idx_a].red)   * (int)frac / (int)step_time;
-		interpolated.green = grp->colors[idx_a].green + (int)(grp->colors[idx_b].green - grp->colors[idx_a].green) * (int)frac / (int)step_time;
-		interpolated.blue  = grp->colors[idx_a].blue  + (int)(grp->colors[idx_b].blue  - grp->colors[idx_a].blue)  * (int)frac / (int)step_time;
+		interpolated.red   = st->from[idx].red   + ((st->delta[idx][0] * (s32)pos + 0x8000) >> 16);
+		interpolated.green = st->from[idx].green + ((st->delta[idx][1] * (s32)pos + 0x8000) >> 16);
+		interpolated.blue  = st->from[idx].blue  + ((st->delta[idx][2] * (s32)pos + 0x8000) >> 16);
 
 		for (z = 0; z < ZONE_COUNT; z++) {
-			if (grp->zone_mask & (1 << z))
+			if (st->zone_mask & (1 << z))
 				colors[z] = interpolated;
 		}
 	}
+	rcu_read_unlock();
+}
 
-	update_all_zones_with_colors(colors);
+typedef void (*animation_render_fn)(struct color_platform *colors,
+				    const struct color_platform *base, u64 cycle,
+				    u32 pos);
+
+/**
+ * struct animation_effect - Built-in effect and its declared rate of change
+ * @render: Frame renderer
+ * @cycle_ms: Length of one effect cycle at speed 1
+ * @samples: Frames per cycle needed for the effect to look smooth
+ * @flags: ANIMATION_FX_* flags
+ */
+struct animation_effect {
+	animation_render_fn render;
+	unsigned int cycle_ms;
+	unsigned int samples;
+	unsigned int flags;
+};
+
+/* Output depends only on @pos and @base */
+#define ANIMATION_FX_PERIODIC	BIT(0)
+
+static const struct animation_effect animation_effects[ANIMATION_COUNT] = {
+	[ANIMATION_BREATHING]	= { animation_breathing, 2000, 40, ANIMATION_FX_PERIODIC },
+	[ANIMATION_RAINBOW]	= { animation_rainbow, 3000, 45, ANIMATION_FX_PERIODIC },
+	[ANIMATION_WAVE]	= { animation_wave, 2000, 16, ANIMATION_FX_PERIODIC },
+	[ANIMATION_PULSE]	= { animation_pulse, 1500, 36, ANIMATION_FX_PERIODIC },
+	[ANIMATION_CHASE]	= { animation_chase, 1200, 12, ANIMATION_FX_PERIODIC },
+	[ANIMATION_SPARKLE]	= { animation_sparkle, 3000, 32, ANIMATION_FX_PERIODIC },
+	[ANIMATION_CANDLE]	= { animation_candle, 100, 6, ANIMATION_FX_PERIODIC },
+	[ANIMATION_AURORA]	= { animation_aurora, 4000, 40, ANIMATION_FX_PERIODIC },
+	[ANIMATION_DISCO]	= { animation_disco, 300, 12, ANIMATION_FX_PERIODIC },
+	[ANIMATION_GRADIENT]	= { animation_gradient, 3000, 30, 0 },
+};
+
+/*
+ * Keyframe cache: one full cycle of a periodic effect, rendered when the
+ * mode or base colors change and played back by cycle position.
+ * Frames are cached before brightness, which is applied at commit time.
+ * Only touched from the render workqueue, or with it idle.
+ */
+struct animation_keyframes {
+	enum animation_mode mode;
+	struct color_platform base[ZONE_COUNT];
+	unsigned int count;
+	struct color_platform (*frames)[ZONE_COUNT];
+};
+
+/* One cache per effect that can run at once: the base and each layer */
+#define ANIMATION_CACHE_SLOTS	(ANIMATION_MAX_LAYERS + 1)
+
+static struct animation_keyframes animation_cache[ANIMATION_CACHE_SLOTS];
+
+static void animation_cache_free(struct animation_keyframes *kf)
+{
+	kvfree(kf->frames);
+	kf->frames = NULL;
+	kf->count = 0;
 }
 
-/* Animation work function - runs in work queue context */
-static void animation_work_func(struct work_struct *work)
+static bool animation_cache_valid(const struct animation_keyframes *kf,
+				  enum animation_mode mode,
+				  const struct color_platform *base)
 {
-	if (!animation_active || current_animation == ANIMATION_STATIC)
-		return;
+	return kf->frames && kf->mode == mode &&
+	       !memcmp(kf->base, base, sizeof(kf->base));
+}
+
+/* Render one cycle of @mode, one frame per ms at speed 1 within the budget */
+static int animation_cache_build(struct animation_keyframes *kf,
+				 enum animation_mode mode,
+				 const struct color_platform *base)
+{
+	const struct animation_effect *fx = &animation_effects[mode];
+	unsigned int max_frames, count, i;
+
+	max_frames = keyframe_cache_kb * 1024 / ANIMATION_CACHE_SLOTS /
+		     sizeof(*kf->frames);
+	count = min(fx->cycle_ms, max_frames);
+	if (!count)
+		return -EINVAL;
+
+	if (count > kf->count) {
+		animation_cache_free(kf);
+		kf->frames = kvmalloc_array(count, sizeof(*kf->frames), GFP_KERNEL);
+		if (!kf->frames)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < count; i++)
+		fx->render(kf->frames[i], base, 0, (i << 16) / count);
+
+	kf->mode = mode;
+	memcpy(kf->base, base, sizeof(kf->base));
+	kf->count = count;
+	return 0;
+}
+
+/* Fill @colors at @phase, from the keyframe cache @kf when possible */
+static void animation_render(struct animation_keyframes *kf,
+			     enum animation_mode mode,
+			     const struct color_platform *base,
+			     struct color_platform *colors, u64 phase)
+{
+	const struct animation_effect *fx = &animation_effects[mode];
+	u64 cycle_ns = (u64)fx->cycle_ms * NSEC_PER_MSEC;
+	u64 cycle, rem;
+	u32 pos;
+
+	cycle = div64_u64_rem(phase, cycle_ns, &rem);
+	pos = div64_u64(rem << 16, cycle_ns);
+
+	if (!(fx->flags & ANIMATION_FX_PERIODIC) || !keyframe_cache_kb)
+		goto live;
+
+	if (!animation_cache_valid(kf, mode, base) &&
+	    animation_cache_build(kf, mode, base))
+		goto live;
 
-	switch (current_animation) {
-	case ANIMATION_BREATHING:
-		animation_breathing();
-		break;
-	case ANIMATION_RAINBOW:
-		animation_rainbow();
-		break;
-	case ANIMATION_WAVE:
-		animation_wave();
-		break;
-	case ANIMATION_PULSE:
-		animation_pulse();
-		break;
-	case ANIMATION_CHASE:
-		animation_chase();
-		break;
-	case ANIMATION_SPARKLE:
-		animation_sparkle();
-		break;
-	case ANIMATION_CANDLE:
-		animation_candle();
-		break;
-	case ANIMATION_AURORA:
-		animation_aurora();
-		break;
-	case ANIMATION_DISCO:
-		animation_disco();
-		break;
-	case ANIMATION_GRADIENT:
-		animation_gradient();
-		break;
+	memcpy(colors, kf->frames[(pos * kf->count) >> 16], sizeof(*kf->frames));
+	atomic64_inc(&animation_frames_cached);
+	return;
+
+live:
+	fx->render(colors, base, cycle, pos);
+}
+
+static bool animation_mode_animated(enum animation_mode mode)
+{
+	return mode != ANIMATION_STATIC && mode < ANIMATION_COUNT &&
+	       animation_effects[mode].render;
+}
+
+/* Whether anything in @rs changes over time and needs the frame clock */
+static bool animation_animated(const struct render_state *rs)
+{
+	int i;
+
+	if (animation_mode_animated(rs->mode))
+		return true;
+
+	for (i = 0; i < rs->layer_count; i++) {
+		if (animation_mode_animated(rs->layers[i].mode))
+			return true;
+	}
+	return false;
+}
+
+static const char * const animation_blend_names[ANIMATION_BLEND_COUNT] = {
+	[ANIMATION_BLEND_REPLACE]	= "replace",
+	[ANIMATION_BLEND_ADD]		= "add",
+	[ANIMATION_BLEND_MULTIPLY]	= "multiply",
+	[ANIMATION_BLEND_ALPHA]		= "alpha",
+};
+
+static u8 animation_blend_channel(enum animation_blend blend, u8 dst, u8 src,
+				  u8 coverage)
+{
+	switch (blend) {
+	case ANIMATION_BLEND_ADD:
+		return min(dst + src, 255);
+	case ANIMATION_BLEND_MULTIPLY:
+		return cf_mul8(dst, src);
+	case ANIMATION_BLEND_ALPHA:
+		return cf_blend8(dst, src, coverage);
 	default:
-		break;
+		return src;
+	}
+}
+
+/* Blend @src over @colors on the zones of @layer, at the layer's opacity */
+static void animation_blend(const struct animation_layer *layer,
+			    struct color_platform *colors,
+			    const struct color_platform *src)
+{
+	for (int zone = 0; zone < ZONE_COUNT; zone++) {
+		struct color_platform *d = &colors[zone];
+		const struct color_platform *s = &src[zone];
+		/* Alpha blending keys on the layer's own intensity: dark is see-through */
+		u8 coverage = max3(s->red, s->green, s->blue);
+
+		if (!(layer->zone_mask & BIT(zone)))
+			continue;
+
+		d->red = cf_blend8(d->red, animation_blend_channel(layer->blend, d->red,
+								   s->red, coverage),
+				   layer->alpha);
+		d->green = cf_blend8(d->green, animation_blend_channel(layer->blend, d->green,
+								       s->green, coverage),
+				     layer->alpha);
+		d->blue = cf_blend8(d->blue, animation_blend_channel(layer->blend, d->blue,
+								     s->blue, coverage),
+				    layer->alpha);
+	}
+}
+
+/*
+ * Composite the base effect and the layer stack of @rs into @colors at
+ * @phase. Static content (base colors, static layers) is copied rather
+ * than rendered. With @animate false only static content is drawn, and
+ * the keyframe caches are not touched.
+ */
+static void animation_compose(const struct render_state *rs,
+			      struct color_platform *colors, u64 phase,
+			      bool animate)
+{
+	struct color_platform base[ZONE_COUNT], src[ZONE_COUNT];
+	int i, zone;
+
+	if (animate && animation_mode_animated(rs->mode))
+		animation_render(&animation_cache[0], rs->mode, rs->colors,
+				 colors, phase);
+	else
+		memcpy(colors, rs->colors, sizeof(rs->colors));
+
+	for (i = 0; i < rs->layer_count; i++) {
+		const struct animation_layer *layer = &rs->layers[i];
+
+		for (zone = 0; zone < ZONE_COUNT; zone++)
+			base[zone] = layer->color;
+
+		if (!animation_mode_animated(layer->mode))
+			memcpy(src, base, sizeof(src));
+		else if (animate)
+			animation_render(&animation_cache[i + 1], layer->mode,
+					 base, src, phase);
+		else
+			continue;
+
+		animation_blend(layer, colors, src);
+	}
+}
+
+void animation_compose_static(const struct render_state *rs,
+			      struct color_platform *colors)
+{
+	animation_compose(rs, colors, 0, false);
+}
+
+/* Frames per second @mode needs to look smooth at @speed, 0 if static */
+static int animation_effect_fps(enum animation_mode mode, int speed)
+{
+	const struct animation_effect *fx = &animation_effects[mode];
+
+	if (!animation_mode_animated(mode))
+		return 0;
+
+	return DIV_ROUND_UP(fx->samples * speed * MSEC_PER_SEC, fx->cycle_ms);
+}
+
+/*
+ * Pick the frame rate for @rs: what its fastest effect needs at the
+ * current speed, capped by animation_fps, lowered when BIOS commits are
+ * slow or frames stop changing. Runs on the render workqueue or with the
+ * frame clock stopped.
+ */
+static void animation_update_rate(const struct render_state *rs)
+{
+	int fps = READ_ONCE(animation_fps);
+	const char *reason = "cap";
+	unsigned long lat_us;
+	unsigned int shift;
+	int want, i;
+
+	if (!adaptive_fps) {
+		reason = "fixed";
+		goto out;
+	}
+
+	want = animation_effect_fps(rs->mode, rs->speed);
+	for (i = 0; i < rs->layer_count; i++)
+		want = max(want, animation_effect_fps(rs->layers[i].mode, rs->speed));
+	if (want < fps) {
+		fps = want;
+		reason = "effect";
+	}
+
+	/* Keep the BIOS idle at least half of the time for fan commands */
+	lat_us = ewma_commit_latency_read(&animation_commit_latency);
+	if (lat_us && USEC_PER_SEC / (2 * lat_us) < (unsigned long)fps) {
+		fps = USEC_PER_SEC / (2 * lat_us);
+		reason = "latency";
+	}
+
+	shift = min(animation_idle_frames / ANIMATION_IDLE_FRAMES, 3U);
+	if (shift) {
+		fps >>= shift;
+		reason = "idle";
+	}
+
+	fps = max(fps, ANIMATION_FPS_MIN);
+out:
+	WRITE_ONCE(animation_period_ns, NSEC_PER_SEC / fps);
+	WRITE_ONCE(animation_fps_current, fps);
+	WRITE_ONCE(animation_fps_reason, reason);
+}
+
+/* Crossfade: blend from @from into @colors at Q16 position @t */
+static void animation_fade(struct color_platform *colors,
+			   const struct color_platform *from, u32 t)
+{
+	for (int zone = 0; zone < ZONE_COUNT; zone++) {
+		colors[zone].red = cf_lerp8(from[zone].red, colors[zone].red, t);
+		colors[zone].green = cf_lerp8(from[zone].green, colors[zone].green, t);
+		colors[zone].blue = cf_lerp8(from[zone].blue, colors[zone].blue, t);
+	}
+}
+
+/* Render one frame and commit it - runs on the render workqueue */
+static void animation_work_func(struct work_struct *work)
+{
+	struct color_platform colors[ZONE_COUNT];
+	u64 tick = READ_ONCE(animation_tick_ns);
+	struct render_state rs;
+	u64 now, done, fade, phase;
+
+	render_state_read(&rs);
+	if (!rs.active)
+		goto out;
+
+	now = ktime_get_ns();
+	fade = now - rs.fade_start_ns;
+	if (fade >= rs.fade_ns && !animation_animated(&rs)) {
+		queue_work(system_wq, &animation_settle_work);
+		goto out;
 	}
+
+	/* Effect time advances at the current speed from the last rebase */
+	phase = rs.phase_base_ns + (now - rs.phase_anchor_ns) * rs.speed;
+	animation_compose(&rs, colors, phase, true);
+	if (fade < rs.fade_ns)
+		animation_fade(colors, rs.fade_from,
+			       div64_u64(fade << 16, rs.fade_ns));
+
+	if (!memcmp(colors, animation_last_frame, sizeof(colors))) {
+		animation_idle_frames++;
+	} else {
+		animation_idle_frames = 0;
+		memcpy(animation_last_frame, colors, sizeof(colors));
+	}
+
+	now = ktime_get_ns();
+	update_all_zones_with_colors(colors);
+	done = ktime_get_ns();
+	atomic64_inc(&animation_frames_rendered);
+
+	ewma_commit_latency_add(&animation_commit_latency,
+				div_u64(done - now, NSEC_PER_USEC) ?: 1);
+	animation_update_rate(&rs);
+
+	/* Shown after the next frame was due */
+	if (done - tick > READ_ONCE(animation_period_ns))
+		atomic64_inc(&animation_frames_late);
+
+out:
+	atomic_set(&animation_render_busy, 0);
+}
+
+/*
+ * Frame clock; never queues a frame behind one still being committed.
+ * Runs until animation_stop() cancels it; the render work decides
+ * whether there is anything to draw.
+ */
+static enum hrtimer_restart animation_timer_callback(struct hrtimer *t)
+{
+	u64 overruns;
+
+	if (atomic_xchg(&animation_render_busy, 1)) {
+		atomic64_inc(&animation_frames_dropped);
+	} else {
+		WRITE_ONCE(animation_tick_ns, ktime_get_ns());
+		queue_work(animation_wq, &animation_work);
+	}
+
+	/* Ticks the timer itself missed are dropped frames as well */
+	overruns = hrtimer_forward_now(t, ns_to_ktime(READ_ONCE(animation_period_ns)));
+	if (overruns > 1)
+		atomic64_add(overruns - 1, &animation_frames_dropped);
+
+	return HRTIMER_RESTART;
+}
+
+void render_state_read(struct render_state *rs)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_latch(&render_state_seq);
+		*rs = render_state_latch[seq & 1];
+	} while (read_seqcount_latch_retry(&render_state_seq, seq));
+}
+
+void render_state_lock(void)
+{
+	mutex_lock(&render_state_mutex);
+}
+
+void render_state_unlock(void)
+{
+	mutex_unlock(&render_state_mutex);
+}
+
+struct render_state *render_state_write_begin(void)
+{
+	lockdep_assert_held(&render_state_mutex);
+	return &render_state;
+}
+
+void render_state_write_end(void)
+{
+	lockdep_assert_held(&render_state_mutex);
+
+	write_seqcount_latch_begin(&render_state_seq);
+	render_state_latch[0] = render_state;
+	write_seqcount_latch(&render_state_seq);
+	render_state_latch[1] = render_state;
+	write_seqcount_latch_end(&render_state_seq);
 }
 
-/* Animation timer callback */
-static void animation_timer_callback(struct timer_list *t)
+static void animation_set_active(bool active)
 {
-	if (animation_active && current_animation != ANIMATION_STATIC) {
-		schedule_work(&animation_work);
-		mod_timer(&animation_timer, jiffies + msecs_to_jiffies(ANIMATION_TIMER_INTERVAL_MS));
+	struct render_state *rs = render_state_write_begin();
+
+	rs->active = active;
+	if (active) {
+		rs->phase_base_ns = 0;
+		rs->phase_anchor_ns = ktime_get_ns();
 	}
+	render_state_write_end();
 }
 
+void animation_rebase_speed(struct render_state *rs, int speed)
+{
+	u64 now = ktime_get_ns();
+
+	/* Rebase: effect time so far at the old speed, the rest at the new one */
+	rs->phase_base_ns += (now - rs->phase_anchor_ns) * rs->speed;
+	rs->phase_anchor_ns = now;
+	rs->speed = speed;
+}
+
+void animation_set_speed(int speed)
+{
+	animation_rebase_speed(render_state_write_begin(), speed);
+	render_state_write_end();
+}
+
+/* Writers hold render_state_mutex, so render_state is stable below */
 void animation_start(void)
 {
-	if (current_animation == ANIMATION_STATIC) {
-		animation_active = false;
+	lockdep_assert_held(&render_state_mutex);
+
+	/* Started by animation_hold(false) from the state recorded meanwhile */
+	if (animation_output_held)
+		return;
+
+	if (!animation_animated(&render_state)) {
+		animation_set_active(false);
 		return;
 	}
 
-	animation_start_time = jiffies;
-	animation_active = true;
+	atomic_set(&animation_render_busy, 0);
+	animation_idle_frames = 0;
+	memset(animation_last_frame, 0, sizeof(animation_last_frame));
+	animation_update_rate(&render_state);
+	animation_set_active(true);
 
-	/* Start the timer (already initialized in animation_init) */
-	mod_timer(&animation_timer, jiffies + msecs_to_jiffies(ANIMATION_TIMER_INTERVAL_MS));
+	hrtimer_start(&animation_timer, ns_to_ktime(READ_ONCE(animation_period_ns)),
+		      HRTIMER_MODE_REL);
 }
 
-void animation_stop(void)
+void animation_halt(void)
 {
-	animation_active = false;
-	timer_delete_sync(&animation_timer);
+	lockdep_assert_held(&render_state_mutex);
+
+	animation_set_active(false);
+	hrtimer_cancel(&animation_timer);
 	cancel_work_sync(&animation_work);
+}
+
+void animation_hold(bool hold)
+{
+	lockdep_assert_held(&render_state_mutex);
+
+	if (hold)
+		animation_halt();
+	WRITE_ONCE(animation_output_held, hold);
+}
+
+bool animation_held(void)
+{
+	return READ_ONCE(animation_output_held);
+}
+
+void animation_stop(void)
+{
+	animation_halt();
 
 	/* Restore original colors */
-	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		zone_data[zone].colors = original_colors[zone].colors;
-		apply_brightness_to_color(&zone_data[zone].colors);
-		fourzone_update_led(&zone_data[zone], HPWMI_WRITE);
-	}
+	update_all_zones_with_original_colors();
+}
+
+/*
+ * The render work cannot stop its own clock: animation_halt() waits for
+ * it under render_state_mutex. Runs on system_wq instead.
+ */
+static void animation_settle_func(struct work_struct *work)
+{
+	render_state_lock();
+	/* Recheck: an effect may have been selected since this was queued */
+	if (render_state.active && !animation_animated(&render_state) &&
+	    ktime_get_ns() - render_state.fade_start_ns >= render_state.fade_ns)
+		animation_stop();
+	render_state_unlock();
+}
+
+void animation_fade_to(struct render_state *rs, enum animation_mode mode,
+		       const struct color_platform *from)
+{
+	rs->mode = mode;
+	memcpy(rs->fade_from, from, sizeof(rs->fade_from));
+	rs->fade_start_ns = ktime_get_ns();
+	rs->fade_ns = (u64)READ_ONCE(animation_transition_ms) * NSEC_PER_MSEC;
+}
+
+void animation_update(void)
+{
+	lockdep_assert_held(&render_state_mutex);
+
+	/* A running clock fades into the new mode, then stops if nothing animates */
+	if (render_state.active)
+		return;
+
+	if (animation_animated(&render_state))
+		animation_start();
+	else
+		update_all_zones_with_original_colors();
+}
+
+/* Crossfade is rendered by the frame clock like any other frame */
+void animation_transition(enum animation_mode mode)
+{
+	struct color_platform from[ZONE_COUNT];
+
+	fourzone_shown_frame(from);
+	animation_fade_to(render_state_write_begin(), mode, from);
+	render_state_write_end();
+	animation_update();
+}
+
+bool animation_queue_work(struct work_struct *work)
+{
+	return queue_work(animation_wq, work);
 }
 
 void animation_set_mode(enum animation_mode mode)
 {
-	current_animation = mode;
+	struct render_state *rs = render_state_write_begin();
+
+	rs->mode = mode;
+	render_state_write_end();
+}
+
+bool animation_running(void)
+{
+	struct render_state rs;
+
+	render_state_read(&rs);
+	return rs.active;
 }
 
 enum animation_mode animation_get_mode(void)
 {
-	return current_animation;
+	struct render_state rs;
+
+	render_state_read(&rs);
+	return rs.mode;
+}
+
+static const char * const animation_mode_names[ANIMATION_COUNT] = {
+	[ANIMATION_STATIC]	= "static",
+	[ANIMATION_BREATHING]	= "breathing",
+	[ANIMATION_RAINBOW]	= "rainbow",
+	[ANIMATION_WAVE]	= "wave",
+	[ANIMATION_PULSE]	= "pulse",
+	[ANIMATION_CHASE]	= "chase",
+	[ANIMATION_SPARKLE]	= "sparkle",
+	[ANIMATION_CANDLE]	= "candle",
+	[ANIMATION_AURORA]	= "aurora",
+	[ANIMATION_DISCO]	= "disco",
+	[ANIMATION_GRADIENT]	= "gradient",
+};
+
+int animation_mode_parse(const char *name)
+{
+	return sysfs_match_string(animation_mode_names, name);
+}
+
+const char *animation_mode_name(enum animation_mode mode)
+{
+	if (mode >= ANIMATION_COUNT)
+		return "unknown";
+	return animation_mode_names[mode];
 }
 
 /* Sysfs attribute callbacks */
 static ssize_t animation_mode_show(struct device *dev, struct device_attribute *attr,
 				   char *buf)
 {
-	const char *mode_names[] = {
-		"static", "breathing", "rainbow", "wave", "pulse",
-		"chase", "sparkle", "candle", "aurora", "disco", "gradient"
-	};
-
-	if (current_animation >= ANIMATION_COUNT)
-		return sprintf(buf, "unknown\n");
-
-	return sprintf(buf, "%s\n", mode_names[current_animation]);
+	return sprintf(buf, "%s\n", animation_mode_name(animation_get_mode()));
 }
 
 static ssize_t animation_mode_set(struct device *dev, struct device_attribute *attr,
 				  const char *buf, size_t count)
 {
-	enum animation_mode new_mode = ANIMATION_STATIC;
-
-	if (strncmp(buf, "static", 6) == 0) {
-		new_mode = ANIMATION_STATIC;
-	} else if (strncmp(buf, "breathing", 9) == 0) {
-		new_mode = ANIMATION_BREATHING;
-	} else if (strncmp(buf, "rainbow", 7) == 0) {
-		new_mode = ANIMATION_RAINBOW;
-	} else if (strncmp(buf, "wave", 4) == 0) {
-		new_mode = ANIMATION_WAVE;
-	} else if (strncmp(buf, "pulse", 5) == 0) {
-		new_mode = ANIMATION_PULSE;
-	} else if (strncmp(buf, "chase", 5) == 0) {
-		new_mode = ANIMATION_CHASE;
-	} else if (strncmp(buf, "sparkle", 7) == 0) {
-		new_mode = ANIMATION_SPARKLE;
-	} else if (strncmp(buf, "candle", 6) == 0) {
-		new_mode = ANIMATION_CANDLE;
-	} else if (strncmp(buf, "aurora", 6) == 0) {
-		new_mode = ANIMATION_AURORA;
-	} else if (strncmp(buf, "disco", 5) == 0) {
-		new_mode = ANIMATION_DISCO;
-	} else if (strncmp(buf, "gradient", 8) == 0) {
-		new_mode = ANIMATION_GRADIENT;
-	} else {
-		return -EINVAL;
-	}
-
-	animation_stop();
+	int new_mode;
 
-	current_animation = new_mode;
+	new_mode = animation_mode_parse(buf);
+	if (new_mode < 0)
+		return new_mode;
 
-	if (new_mode != ANIMATION_STATIC) {
-		animation_start();
-	}
+	render_state_lock();
+	animation_transition(new_mode);
 
 	/* Save state */
 	save_animation_state();
+	render_state_unlock();
 
 	return count;
 }
@@ -468,7 +957,10 @@ static ssize_t animation_mode_set(struct device *dev, struct device_attribute *a
 static ssize_t animation_speed_show(struct device *dev, struct device_attribute *attr,
 				    char *buf)
 {
-	return sprintf(buf, "%d\n", animation_speed);
+	struct render_state rs;
+
+	render_state_read(&rs);
+	return sprintf(buf, "%d\n", rs.speed);
 }
 
 static ssize_t animation_speed_set(struct device *dev, struct device_attribute *attr,
@@ -484,28 +976,75 @@ static ssize_t animation_speed_set(struct device *dev, struct device_attribute *
 	if (speed < ANIMATION_SPEED_MIN || speed > ANIMATION_SPEED_MAX)
 		return -EINVAL;
 
-	animation_speed = speed;
-
-	if (animation_active && current_animation != ANIMATION_STATIC) {
-		animation_stop();
-		animation_start();
-	}
+	/* The running effect continues from where it is, at the new speed */
+	render_state_lock();
+	animation_set_speed(speed);
 
 	/* Save state */
 	save_animation_state();
+	render_state_unlock();
 
 	return count;
 }
 
+void gradient_config_get(struct gradient_config *cfg)
+{
+	const struct gradient_state *gs;
+
+	rcu_read_lock();
+	gs = rcu_dereference(gradient_state);
+	if (gs)
+		*cfg = gs->cfg;
+	else
+		memset(cfg, 0, sizeof(*cfg));
+	rcu_read_unlock();
+}
+
+int gradient_config_publish(const struct gradient_config *cfg)
+{
+	struct gradient_state *gs, *old;
+	int g, c;
+
+	gs = kzalloc(sizeof(*gs), GFP_KERNEL);
+	if (!gs)
+		return -ENOMEM;
+
+	gs->cfg = *cfg;
+	for (g = 0; g < cfg->group_count; g++) {
+		const struct gradient_group *grp = &cfg->groups[g];
+		struct gradient_group_steps *st = &gs->steps[g];
+
+		st->zone_mask = grp->zone_mask;
+		st->color_count = grp->color_count;
+		for (c = 0; c < grp->color_count; c++) {
+			const struct color_platform *a = &grp->colors[c];
+			const struct color_platform *b = &grp->colors[(c + 1) % grp->color_count];
+
+			st->from[c] = *a;
+			st->delta[c][0] = b->red - a->red;
+			st->delta[c][1] = b->green - a->green;
+			st->delta[c][2] = b->blue - a->blue;
+		}
+	}
+
+	mutex_lock(&gradient_cfg_mutex);
+	old = rcu_dereference_protected(gradient_state,
+					lockdep_is_held(&gradient_cfg_mutex));
+	rcu_assign_pointer(gradient_state, gs);
+	mutex_unlock(&gradient_cfg_mutex);
+
+	if (old)
+		kfree_rcu(old, rcu);
+	return 0;
+}
+
 static ssize_t gradient_config_show(struct device *dev, struct device_attribute *attr,
 				    char *buf)
 {
 	struct gradient_config cfg_snapshot;
 	int g, z, c, len = 0;
 
-	mutex_lock(&gradient_cfg_mutex);
-	cfg_snapshot = gradient_cfg;
-	mutex_unlock(&gradient_cfg_mutex);
+	gradient_config_get(&cfg_snapshot);
 
 	for (g = 0; g < cfg_snapshot.group_count; g++) {
 		struct gradient_group *grp = &cfg_snapshot.groups[g];
@@ -553,6 +1092,7 @@ static ssize_t gradient_config_set(struct device *dev, struct device_attribute *
 	char local_buf[512];
 	char *group_str, *groups_ptr;
 	int g = 0;
+	int ret;
 
 	if (count == 0)
 		return -EINVAL;
@@ -639,10 +1179,9 @@ static ssize_t gradient_config_set(struct device *dev, struct device_attribute *
 	if (new_cfg.group_count == 0)
 		return -EINVAL;
 
-	/* Apply new config under lock */
-	mutex_lock(&gradient_cfg_mutex);
-	gradient_cfg = new_cfg;
-	mutex_unlock(&gradient_cfg_mutex);
+	ret = gradient_config_publish(&new_cfg);
+	if (ret)
+		return ret;
 
 	/* Save state */
 	save_animation_state();
@@ -650,21 +1189,272 @@ static ssize_t gradient_config_set(struct device *dev, struct device_attribute *
 	return count;
 }
 
+/*
+ * Layer stack, one layer per ';':
+ *   mode=<name> [color=RRGGBB] [zones=0,1,..] [blend=<name>] [alpha=0-255]
+ * Defaults: white, all zones, replace, opaque. "none" clears the stack.
+ */
+static int animation_layer_parse(char *str, struct animation_layer *layer)
+{
+	struct platform_zone temp;
+	bool have_mode = false;
+	char *tok;
+	int ret;
+
+	*layer = (struct animation_layer) {
+		.mode = ANIMATION_STATIC,
+		.blend = ANIMATION_BLEND_REPLACE,
+		.alpha = 255,
+		.zone_mask = BIT(ZONE_COUNT) - 1,
+		.color = { .red = 255, .green = 255, .blue = 255 },
+	};
+
+	while ((tok = strsep(&str, " \t")) != NULL) {
+		char *val = tok;
+		char *key;
+
+		if (*tok == '\0')
+			continue;
+
+		key = strsep(&val, "=");
+		if (!val)
+			return -EINVAL;
+
+		if (!strcmp(key, "mode")) {
+			ret = animation_mode_parse(val);
+			if (ret < 0)
+				return ret;
+			layer->mode = ret;
+			have_mode = true;
+		} else if (!strcmp(key, "color")) {
+			ret = parse_rgb(val, &temp);
+			if (ret)
+				return ret;
+			layer->color = temp.colors;
+		} else if (!strcmp(key, "zones")) {
+			char *z;
+			u8 zone;
+
+			layer->zone_mask = 0;
+			while ((z = strsep(&val, ",")) != NULL) {
+				if (kstrtou8(z, 10, &zone) || zone >= ZONE_COUNT)
+					return -EINVAL;
+				layer->zone_mask |= BIT(zone);
+			}
+		} else if (!strcmp(key, "blend")) {
+			ret = sysfs_match_string(animation_blend_names, val);
+			if (ret < 0)
+				return ret;
+			layer->blend = ret;
+		} else if (!strcmp(key, "alpha")) {
+			if (kstrtou8(val, 10, &layer->alpha))
+				return -EINVAL;
+		} else {
+			return -EINVAL;
+		}
+	}
+
+	return have_mode ? 0 : -EINVAL;
+}
+
+static ssize_t animation_layers_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct render_state rs;
+	int i, z, len = 0;
+
+	render_state_read(&rs);
+	if (!rs.layer_count)
+		return sprintf(buf, "none\n");
+
+	for (i = 0; i < rs.layer_count; i++) {
+		const struct animation_layer *layer = &rs.layers[i];
+		bool first = true;
+
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%smode=%s color=%02x%02x%02x zones=",
+				 i ? "; " : "", animation_mode_name(layer->mode),
+				 layer->color.red, layer->color.green,
+				 layer->color.blue);
+		for (z = 0; z < ZONE_COUNT; z++) {
+			if (!(layer->zone_mask & BIT(z)))
+				continue;
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%s%d",
+					 first ? "" : ",", z);
+			first = false;
+		}
+		len += scnprintf(buf + len, PAGE_SIZE - len, " blend=%s alpha=%u",
+				 animation_blend_names[layer->blend], layer->alpha);
+	}
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+
+	return len;
+}
+
+static ssize_t animation_layers_set(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct animation_layer layers[ANIMATION_MAX_LAYERS];
+	struct render_state *rs;
+	char local_buf[512];
+	char *p, *str;
+	int n = 0;
+	int ret;
+
+	if (count >= sizeof(local_buf))
+		return -EINVAL;
+	strscpy(local_buf, buf, count + 1);
+
+	p = strim(local_buf);
+	if (!strcmp(p, "none"))
+		p = NULL;
+
+	while ((str = strsep(&p, ";")) != NULL) {
+		str = skip_spaces(str);
+		if (*str == '\0')
+			continue;
+
+		if (n >= ANIMATION_MAX_LAYERS)
+			return -EINVAL;
+
+		ret = animation_layer_parse(str, &layers[n]);
+		if (ret)
+			return ret;
+		n++;
+	}
+
+	render_state_lock();
+	rs = render_state_write_begin();
+	memcpy(rs->layers, layers, n * sizeof(*layers));
+	rs->layer_count = n;
+	render_state_write_end();
+
+	/* A running frame clock picks the new stack up on its next frame */
+	if (!animation_animated(&render_state))
+		animation_stop();
+	else if (!render_state.active)
+		animation_start();
+	render_state_unlock();
+
+	return count;
+}
+
+static ssize_t animation_transition_show(struct device *dev,
+					 struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(animation_transition_ms));
+}
+
+static ssize_t animation_transition_set(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	unsigned int ms;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &ms);
+	if (ret)
+		return ret;
+
+	if (ms > ANIMATION_TRANSITION_MS_MAX)
+		return -EINVAL;
+
+	/* Used from the next mode change on */
+	WRITE_ONCE(animation_transition_ms, ms);
+
+	return count;
+}
+
+static ssize_t animation_fps_show(struct device *dev, struct device_attribute *attr,
+				  char *buf)
+{
+	return sprintf(buf, "%d\n", animation_fps);
+}
+
+static ssize_t animation_fps_set(struct device *dev, struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	unsigned long fps;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &fps);
+	if (ret)
+		return ret;
+
+	if (fps < ANIMATION_FPS_MIN || fps > ANIMATION_FPS_MAX)
+		return -EINVAL;
+
+	/* Picked up by the frame clock after its next frame */
+	WRITE_ONCE(animation_fps, fps);
+
+	return count;
+}
+
+static ssize_t animation_fps_current_show(struct device *dev,
+					  struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d (%s)\n", READ_ONCE(animation_fps_current),
+		       READ_ONCE(animation_fps_reason));
+}
+
+static ssize_t render_stats_show(struct device *dev, struct device_attribute *attr,
+				 char *buf)
+{
+	return sprintf(buf, "rendered: %lld\ndropped: %lld\nlate: %lld\ncached: %lld\n",
+		       atomic64_read(&animation_frames_rendered),
+		       atomic64_read(&animation_frames_dropped),
+		       atomic64_read(&animation_frames_late),
+		       atomic64_read(&animation_frames_cached));
+}
+
 struct device_attribute animation_brightness_attr = __ATTR(brightness, 0664, brightness_show, brightness_set);
 struct device_attribute animation_mode_attr = __ATTR(animation_mode, 0664, animation_mode_show, animation_mode_set);
 struct device_attribute animation_speed_attr = __ATTR(animation_speed, 0664, animation_speed_show, animation_speed_set);
 struct device_attribute gradient_config_attr = __ATTR(gradient_config, 0664, gradient_config_show, gradient_config_set);
+struct device_attribute animation_fps_attr = __ATTR(animation_fps, 0664, animation_fps_show, animation_fps_set);
+struct device_attribute animation_fps_current_attr = __ATTR(animation_fps_current, 0444, animation_fps_current_show, NULL);
+struct device_attribute render_stats_attr = __ATTR(render_stats, 0444, render_stats_show, NULL);
+struct device_attribute animation_transition_attr = __ATTR(transition_ms, 0664, animation_transition_show, animation_transition_set);
+struct device_attribute animation_layers_attr = __ATTR(layers, 0664, animation_layers_show, animation_layers_set);
 
-void animation_init(void)
+int animation_init(void)
 {
+	unsigned int flags = render_highpri ? WQ_HIGHPRI : 0;
+
+	animation_wq = alloc_ordered_workqueue("omen_rgb_render", flags);
+	if (!animation_wq)
+		return -ENOMEM;
+
+	ewma_commit_latency_init(&animation_commit_latency);
 	INIT_WORK(&animation_work, animation_work_func);
-	timer_setup(&animation_timer, animation_timer_callback, 0);
+	INIT_WORK(&animation_settle_work, animation_settle_func);
+	hrtimer_setup(&animation_timer, animation_timer_callback, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+	return 0;
 }
 
 void animation_cleanup(void)
 {
+	struct gradient_state *gs;
+	int i;
+
+	render_state_lock();
 	animation_stop();
+	render_state_unlock();
+	cancel_work_sync(&animation_settle_work);
 
-	/* Cancel any pending work */
-	cancel_work_sync(&animation_work);
+	destroy_workqueue(animation_wq);
+	animation_wq = NULL;
+
+	mutex_lock(&gradient_cfg_mutex);
+	gs = rcu_dereference_protected(gradient_state,
+				       lockdep_is_held(&gradient_cfg_mutex));
+	RCU_INIT_POINTER(gradient_state, NULL);
+	mutex_unlock(&gradient_cfg_mutex);
+	if (gs)
+		kfree_rcu(gs, rcu);
+
+	for (i = 0; i < ANIMATION_CACHE_SLOTS; i++)
+		animation_cache_free(&animation_cache[i]);
 }
@@ -12,6 +12,9 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/wmi.h>
+#include <linux/async.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <generated/utsrelease.h>
 
 #include "omen_rgb_keyboard.h"
@@ -21,6 +24,7 @@
 #include "omen_animations.h"
 #include "omen_state.h"
 #include "omen_hda_led.h"
+#include "omen_stream.h"
 
 MODULE_AUTHOR("alessandromrc");
 MODULE_DESCRIPTION(DRIVER_DESC);
@@ -29,15 +33,112 @@ MODULE_LICENSE("GPL");
 
 static struct platform_device *hp_wmi_platform_dev;
 
+/*
+ * Only the lighting path runs in the probe itself; fan detection and
+ * HDA codec discovery are slow BIOS/codec scans nothing else waits for
+ * and run in parallel from here. Module load still waits for them
+ * unless loaded with async_probe.
+ */
+static ASYNC_DOMAIN_EXCLUSIVE(omen_probe_domain);
+
+enum omen_probe_phase {
+	PROBE_TRANSPORT,
+	PROBE_CAPS,
+	PROBE_LIGHTING,
+	PROBE_LED,
+	PROBE_STREAM,
+	PROBE_INPUT,
+	PROBE_SYNC,
+	PROBE_FAN,
+	PROBE_HDA,
+	PROBE_PHASE_COUNT
+};
+
+static const char * const probe_phase_names[PROBE_PHASE_COUNT] = {
+	[PROBE_TRANSPORT] = "transport",
+	[PROBE_CAPS] = "capabilities",
+	[PROBE_LIGHTING] = "lighting",
+	[PROBE_LED] = "led_classdev",
+	[PROBE_STREAM] = "stream",
+	[PROBE_INPUT] = "input",
+	[PROBE_SYNC] = "sync_total",
+	[PROBE_FAN] = "fan (async)",
+	[PROBE_HDA] = "hda (async)",
+};
+
+/* Times relative to the start of module init, written once per phase */
+static u64 probe_start_ns;
+static u64 probe_phase_end_ns[PROBE_PHASE_COUNT];
+static u64 probe_phase_len_ns[PROBE_PHASE_COUNT];
+
+static void probe_phase_done(enum omen_probe_phase phase, u64 start)
+{
+	u64 now = ktime_get_ns();
+
+	probe_phase_len_ns[phase] = now - start;
+	smp_store_release(&probe_phase_end_ns[phase], now - probe_start_ns);
+}
+
+static int probe_timing_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	seq_puts(m, "phase          duration_us  done_at_us\n");
+	for (i = 0; i < PROBE_PHASE_COUNT; i++) {
+		u64 end = smp_load_acquire(&probe_phase_end_ns[i]);
+
+		/* Still running, or skipped */
+		if (!end)
+			continue;
+		seq_printf(m, "%-14s %11llu %11llu\n", probe_phase_names[i],
+			   probe_phase_len_ns[i] / NSEC_PER_USEC,
+			   end / NSEC_PER_USEC);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(probe_timing);
+
+static void omen_probe_fan(void *data, async_cookie_t cookie)
+{
+	struct platform_device *device = data;
+	static char *envp[] = { "OMEN_RGB_FAN=ready", NULL };
+	u64 t0 = ktime_get_ns();
+	int ret;
+
+	ret = omen_fan_setup(device);
+	probe_phase_done(PROBE_FAN, t0);
+	if (ret) {
+		pr_warn("Fan control sysfs unavailable: %d\n", ret);
+		return;
+	}
+
+	/* The fan group appears after bind; let udev fix up its permissions */
+	kobject_uevent_env(&device->dev.kobj, KOBJ_CHANGE, envp);
+}
+
+static void omen_probe_hda(void *data, async_cookie_t cookie)
+{
+	u64 t0 = ktime_get_ns();
+	int ret;
+
+	ret = omen_hda_led_init();
+	probe_phase_done(PROBE_HDA, t0);
+	if (ret) {
+		pr_warn("Failed to initialize HDA LED control: %d\n", ret);
+		/* Non-fatal, continue anyway */
+	}
+}
+
 static int __init hp_wmi_bios_setup(struct platform_device *device)
 {
+	u64 probe_t0 = ktime_get_ns();
+	u64 t0 = probe_t0;
 	int ret;
 	
 	/* Initialize animation system */
-	animation_init();
-	
-	/* Load saved state */
-	load_animation_state();
+	ret = animation_init();
+	if (ret)
+		return ret;
 	
 	/* Setup zones and create sysfs attributes */
 	ret = fourzone_setup(device);
@@ -45,60 +146,107 @@ static int __init hp_wmi_bios_setup(struct platform_device *device)
 		animation_cleanup();
 		return ret;
 	}
+	probe_phase_done(PROBE_LIGHTING, t0);
 
+	ret = device_create_file(&device->dev, &hp_wmi_caps_attr);
+	if (ret)
+		pr_warn("Failed to create capabilities attribute: %d\n", ret);
+
+	async_schedule_domain(omen_probe_fan, device, &omen_probe_domain);
+	async_schedule_domain(omen_probe_hda, NULL, &omen_probe_domain);
+
+	t0 = ktime_get_ns();
 	ret = devm_led_classdev_register(&device->dev, &omen_kbd_led);
 	if (ret)
 		pr_warn("Failed to register keyboard LED classdev: %d\n", ret);
+	probe_phase_done(PROBE_LED, t0);
 
-	ret = omen_fan_setup(device);
+	/* Saving and restoring the state is up to userspace */
+	ret = omen_state_init(&device->dev);
 	if (ret)
-		pr_warn("Fan control sysfs unavailable: %d\n", ret);
+		pr_warn("State changes will not be flushed before suspend: %d\n", ret);
+
+	t0 = ktime_get_ns();
+	ret = omen_stream_setup();
+	if (ret)
+		pr_warn("Frame streaming device unavailable: %d\n", ret);
+	probe_phase_done(PROBE_STREAM, t0);
 
 	/* Setup input device for Omen key handling */
+	t0 = ktime_get_ns();
 	ret = hp_wmi_input_setup();
 	if (ret) {
 		pr_warn("Failed to setup input device: %d\n", ret);
 	}
-	
-	/* Initialize HDA LED control for mute button */
-	ret = omen_hda_led_init();
-	if (ret) {
-		pr_warn("Failed to initialize HDA LED control: %d\n", ret);
-		/* Non-fatal, continue anyway */
-	}
+	probe_phase_done(PROBE_INPUT, t0);
 	
 	/* Start animation if not static */
+	render_state_lock();
 	if (animation_get_mode() != ANIMATION_STATIC) {
 		animation_start();
 	}
-	
+	render_state_unlock();
+
+	probe_phase_done(PROBE_SYNC, probe_t0);
 	return 0;
 }
 
+static int hp_wmi_resume(struct device *dev)
+{
+	/* BIOS may have reset the lighting while we were asleep */
+	fourzone_shadow_invalidate();
+	return 0;
+}
+
+static DEFINE_SIMPLE_DEV_PM_OPS(hp_wmi_pm_ops, NULL, hp_wmi_resume);
+
 static struct platform_driver hp_wmi_driver = {
 	.driver = {
 		.name = DRIVER_NAME,
+		.pm = pm_sleep_ptr(&hp_wmi_pm_ops),
 	},
 	.remove = NULL,
 };
 
 static int __init hp_wmi_init(void)
 {
-	int bios_capable = wmi_has_guid(HPWMI_BIOS_GUID);
+	u64 t0;
 	int err;
 	
+	probe_start_ns = ktime_get_ns();
+	t0 = probe_start_ns;
+
 	/* Print driver info */
 	pr_info("== HP OMEN RGB Keyboard Driver v%s (kernel %s) by alessandromrc ==\n", 
 		DRIVER_VERSION, UTS_RELEASE);
 	
-	if (!bios_capable) {
+	err = hp_wmi_transport_init();
+	if (err)
+		return err;
+
+	if (!hp_wmi_transport_has_bios()) {
 		pr_err("HP WMI BIOS GUID %s not found, driver not loaded\n", HPWMI_BIOS_GUID);
 		return -ENODEV;
 	}
 
+	probe_phase_done(PROBE_TRANSPORT, t0);
+
+	err = hp_wmi_debugfs_init();
+	if (err)
+		pr_warn("WMI statistics unavailable: %d\n", err);
+	else
+		debugfs_create_file("probe_timing", 0444, hp_wmi_debugfs_root(),
+				    NULL, &probe_timing_fops);
+
+	/* Everything below asks the cached capabilities instead of the BIOS */
+	t0 = ktime_get_ns();
+	hp_wmi_caps_probe();
+	probe_phase_done(PROBE_CAPS, t0);
+
 	hp_wmi_platform_dev = platform_device_register_simple(DRIVER_NAME, -1, NULL, 0);
 	if (IS_ERR(hp_wmi_platform_dev)) {
 		pr_err("failed to register platform device\n");
+		hp_wmi_debugfs_cleanup();
 		return PTR_ERR(hp_wmi_platform_dev);
 	}
 
@@ -106,6 +254,7 @@ static int __init hp_wmi_init(void)
 	if (err) {
 		pr_err("platform_driver_probe failed with %d\n", err);
 		platform_device_unregister(hp_wmi_platform_dev);
+		hp_wmi_debugfs_cleanup();
 		return err;
 	}
 	
@@ -116,12 +265,24 @@ module_init(hp_wmi_init);
 
 static void __exit hp_wmi_exit(void)
 {
+	/* Fan and HDA setup may still be running with async_probe */
+	async_synchronize_full_domain(&omen_probe_domain);
+
+	/* No sysfs store may restart the frame clock from here on */
+	fourzone_remove_sysfs();
+
 	/* Cleanup HDA LED control */
 	omen_hda_led_cleanup();
 	
 	/* Cleanup input device */
 	hp_wmi_input_cleanup();
 	
+	/* Stop userspace frames before the render workqueue goes away */
+	omen_stream_cleanup();
+
+	/* Announce a pending change while the render state exists, then stop */
+	omen_state_cleanup();
+
 	/* Stop animations and cleanup */
 	animation_cleanup();
 	
@@ -131,9 +292,12 @@ static void __exit hp_wmi_exit(void)
 	fourzone_cleanup();
 	
 	if (hp_wmi_platform_dev) {
+		device_remove_file(&hp_wmi_platform_dev->dev, &hp_wmi_caps_attr);
 		platform_device_unregister(hp_wmi_platform_dev);
 		platform_driver_unregister(&hp_wmi_driver);
 	}
+
+	hp_wmi_debugfs_cleanup();
 	
 	pr_info("Driver unloaded\n");
 }
@@ -95,13 +95,33 @@ static char curve_tz_name[FAN_TZ_NAME_SZ];
 
 static bool fan_curve_manual_off;
 
+/*
+ * Preallocated WMI contexts, under fan_lock: RPM polling at normal
+ * priority, curve applies and max fan at fan priority.
+ */
+static struct hp_wmi_ctx *fan_poll_ctx;
+static struct hp_wmi_ctx *fan_ctx;
+
+static int fan_query(int query, void *buffer, int insize, int outsize)
+{
+	lockdep_assert_held(&fan_lock);
+	return hp_wmi_perform_query_ctx(fan_ctx, query, HPWMI_GAMING, buffer,
+					insize, outsize);
+}
+
+static int fan_poll_query(int query, void *buffer, int insize, int outsize)
+{
+	lockdep_assert_held(&fan_lock);
+	return hp_wmi_perform_query_ctx(fan_poll_ctx, query, HPWMI_GAMING,
+					buffer, insize, outsize);
+}
+
 static int fan_victus_userdefine_trigger(void)
 {
 	u8 fc[4] = {};
 	int ret;
 
-	ret = hp_wmi_perform_query(HPWMI_GM_FAN_COUNT, HPWMI_GAMING, fc,
-				   sizeof(u8), sizeof(fc));
+	ret = fan_query(HPWMI_GM_FAN_COUNT, fc, sizeof(u8), sizeof(fc));
 	if (ret)
 		return -EIO;
 	return fc[0];
@@ -145,8 +165,8 @@ static int fan_rpm_classic(int fan_idx)
 	char fan_data[4] = { fan_idx, 0, 0, 0 };
 	int ret;
 
-	ret = hp_wmi_perform_query(HPWMI_GM_FAN_SPEED_GET, HPWMI_GAMING,
-				   fan_data, sizeof(char), sizeof(fan_data));
+	ret = fan_poll_query(HPWMI_GM_FAN_SPEED_GET, fan_data, sizeof(char),
+			     sizeof(fan_data));
 	if (ret)
 		return -EIO;
 
@@ -161,8 +181,8 @@ static int fan_rpm_victus(int fan_idx)
 	if (fan_idx < 0 || fan_idx >= (int)sizeof(buf))
 		return -EINVAL;
 
-	ret = hp_wmi_perform_query(HPWMI_GM_VICTUS_FAN_SPEED_GET, HPWMI_GAMING,
-				   buf, sizeof(u8), sizeof(buf));
+	ret = fan_poll_query(HPWMI_GM_VICTUS_FAN_SPEED_GET, buf, sizeof(u8),
+			     sizeof(buf));
 	if (ret)
 		return -EIO;
 
@@ -183,26 +203,13 @@ static int fan_rpm_read(int channel)
 
 static void fan_detect_iface(void)
 {
-	char fd[4] = { 0, 0, 0, 0 };
-	u8 big[128] = {};
-	int ret_classic, ret_victus;
-
-	ret_victus = hp_wmi_perform_query(HPWMI_GM_VICTUS_FAN_SPEED_GET,
-					  HPWMI_GAMING, big, sizeof(u8),
-					  sizeof(big));
-	if (!ret_victus) {
+	/* Answered by the capability probe at load, no BIOS calls here */
+	if (hp_wmi_has_cap(HPWMI_CAP_VICTUS_FAN_SPEED))
 		fan_iface = OMEN_FAN_IF_VICTUS_S;
-		return;
-	}
-
-	ret_classic = hp_wmi_perform_query(HPWMI_GM_FAN_SPEED_GET, HPWMI_GAMING,
-					   fd, sizeof(char), sizeof(fd));
-	if (!ret_classic) {
+	else if (hp_wmi_has_cap(HPWMI_CAP_FAN_SPEED))
 		fan_iface = OMEN_FAN_IF_CLASSIC;
-		return;
-	}
-
-	fan_iface = OMEN_FAN_IF_NONE;
+	else
+		fan_iface = OMEN_FAN_IF_NONE;
 }
 
 static int fan_wmi_performance_set(u8 mode_byte)
@@ -243,10 +250,10 @@ static int fan_ec_profile_byte(u8 *out)
 {
 	int ret;
 
-	ret = ec_read(HP_OMEN_EC_THERMAL_PROFILE_OFFSET, out);
+	ret = hp_wmi_ec_read(HP_OMEN_EC_THERMAL_PROFILE_OFFSET, out);
 	if (!ret)
 		return 0;
-	return ec_read(HP_VICTUS_S_EC_THERMAL_PROFILE_OFFSET, out);
+	return hp_wmi_ec_read(HP_VICTUS_S_EC_THERMAL_PROFILE_OFFSET, out);
 }
 
 static const char *fan_ec_byte_to_name(u8 b)
@@ -302,14 +309,13 @@ static int fan_victus_wmi_speed_set(u8 cpu_spd)
 	{
 		int z = 0;
 
-		ret = hp_wmi_perform_query(HPWMI_GM_FAN_SPEED_MAX_SET, HPWMI_GAMING,
-					   &z, sizeof(z), 0);
+		ret = fan_query(HPWMI_GM_FAN_SPEED_MAX_SET, &z, sizeof(z), 0);
 	}
 	if (ret)
 		pr_debug("fan max clear before manual set: %d\n", ret);
 
-	ret = hp_wmi_perform_query(HPWMI_GM_VICTUS_FAN_SPEED_SET, HPWMI_GAMING,
-				   fan_speed, sizeof(fan_speed), 0);
+	ret = fan_query(HPWMI_GM_VICTUS_FAN_SPEED_SET, fan_speed,
+			sizeof(fan_speed), 0);
 	return ret ? -EIO : 0;
 }
 
@@ -505,8 +511,8 @@ static void fan_max_keepalive_fn(struct work_struct *work)
 	if (!fan_max_keepalive_armed || !max_fan_state)
 		return;
 
-	ret = hp_wmi_perform_query(HPWMI_GM_FAN_SPEED_MAX_SET, HPWMI_GAMING,
-				   &en, sizeof(en), 0);
+	ret = hp_wmi_perform_query_prio(HPWMI_PRIO_FAN, HPWMI_GM_FAN_SPEED_MAX_SET,
+					HPWMI_GAMING, &en, sizeof(en), 0);
 	if (ret)
 		pr_debug("fan max keepalive failed: %d\n", ret);
 
@@ -604,8 +610,8 @@ static ssize_t max_fan_store(struct device *dev,
 	if (fan_iface == OMEN_FAN_IF_VICTUS_S && v)
 		fan_victus_userdefine_trigger();
 
-	ret = hp_wmi_perform_query(HPWMI_GM_FAN_SPEED_MAX_SET, HPWMI_GAMING,
-				   &enabled, sizeof(enabled), 0);
+	ret = hp_wmi_perform_query_prio(HPWMI_PRIO_FAN, HPWMI_GM_FAN_SPEED_MAX_SET,
+					HPWMI_GAMING, &enabled, sizeof(enabled), 0);
 	if (ret) {
 		mutex_unlock(&fan_lock);
 		return -EIO;
@@ -851,13 +857,24 @@ static struct attribute *fan_attrs[] = {
 	NULL,
 };
 
+/* max_fan reads the state back; only offered where the BIOS answers that */
+static umode_t fan_attr_is_visible(struct kobject *kobj, struct attribute *attr,
+				   int n)
+{
+	if (attr == &dev_attr_max_fan.attr && !hp_wmi_has_cap(HPWMI_CAP_FAN_MAX))
+		return 0;
+	return attr->mode;
+}
+
 static struct attribute_group fan_attr_group = {
 	.name = "fan",
 	.attrs = fan_attrs,
+	.is_visible = fan_attr_is_visible,
 };
 
 int omen_fan_setup(struct platform_device *pdev)
 {
+	const char *max;
 	int ret;
 
 	fan_detect_iface();
@@ -875,19 +892,30 @@ int omen_fan_setup(struct platform_device *pdev)
 	INIT_DELAYED_WORK(&fan_curve_work, fan_curve_work_fn);
 	fan_pdev = pdev;
 
+	/* Largest polled reply is the 128-byte Victus speed buffer */
+	fan_poll_ctx = hp_wmi_ctx_alloc(128, HPWMI_PRIO_NORMAL);
+	fan_ctx = hp_wmi_ctx_alloc(4, HPWMI_PRIO_FAN);
+	if (!fan_poll_ctx || !fan_ctx)
+		pr_warn("no preallocated WMI context for fan control\n");
+
 	ret = sysfs_create_group(&pdev->dev.kobj, &fan_attr_group);
 	if (ret) {
 		pr_warn("failed to create fan sysfs group: %d\n", ret);
 		fan_pdev = NULL;
+		hp_wmi_ctx_free(fan_poll_ctx);
+		hp_wmi_ctx_free(fan_ctx);
+		fan_poll_ctx = NULL;
+		fan_ctx = NULL;
 		return ret;
 	}
 
+	max = hp_wmi_has_cap(HPWMI_CAP_FAN_MAX) ? ", max fan" : "";
 	if (fan_iface == OMEN_FAN_IF_CLASSIC)
-		pr_info("fan interface: classic WMI (RPM read, max fan)\n");
+		pr_info("fan interface: classic WMI (RPM read%s)\n", max);
 	else if (fan_iface == OMEN_FAN_IF_VICTUS_S)
-		pr_info("fan interface: Victus-S WMI (RPM read, max fan, curve)\n");
+		pr_info("fan interface: Victus-S WMI (RPM read%s, curve)\n", max);
 	else
-		pr_info("fan interface: RPM queries unsupported; max_fan may still work\n");
+		pr_info("fan interface: RPM queries unsupported%s\n", max);
 
 	return 0;
 }
@@ -906,6 +934,10 @@ void omen_fan_cleanup(void)
 	hp_wmi_perform_query(HPWMI_GM_FAN_SPEED_MAX_SET, HPWMI_GAMING,
 			     &z, sizeof(z), 0);
 	max_fan_state = 0;
+	hp_wmi_ctx_free(fan_poll_ctx);
+	hp_wmi_ctx_free(fan_ctx);
+	fan_poll_ctx = NULL;
+	fan_ctx = NULL;
 	mutex_unlock(&fan_lock);
 
 	if (fan_pdev) {
@@ -13,11 +13,16 @@
 #include <linux/device.h>
 #include <linux/types.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "omen_zones.h"
 
 /* Animation system constants */
-#define ANIMATION_TIMER_INTERVAL_MS 50
+#define ANIMATION_TRANSITION_MS_MAX 10000
+#define ANIMATION_TRANSITION_MS_DEFAULT 250
+#define ANIMATION_FPS_MIN 5
+#define ANIMATION_FPS_MAX 60
+#define ANIMATION_FPS_DEFAULT 20
 #define ANIMATION_SPEED_MIN 1
 #define ANIMATION_SPEED_MAX 10
 #define ANIMATION_SPEED_DEFAULT 1
@@ -52,23 +57,119 @@ struct gradient_config {
 	struct gradient_group groups[GRADIENT_MAX_GROUPS];
 };
 
-/* External animation state */
-extern enum animation_mode current_animation;
-extern int animation_speed;
-extern bool animation_active;
-extern struct gradient_config gradient_cfg;
-extern struct mutex gradient_cfg_mutex;
+/* Effect layers composited over the base animation */
+#define ANIMATION_MAX_LAYERS 4
+
+enum animation_blend {
+	ANIMATION_BLEND_REPLACE = 0,
+	ANIMATION_BLEND_ADD,
+	ANIMATION_BLEND_MULTIPLY,
+	ANIMATION_BLEND_ALPHA,
+	ANIMATION_BLEND_COUNT
+};
+
+/**
+ * struct animation_layer - Effect drawn on top of the layers below it
+ * @mode: Effect; ANIMATION_STATIC draws @color unchanged
+ * @blend: How the effect combines with what is below
+ * @alpha: Opacity of the blended result, 255 is opaque
+ * @zone_mask: Zones the layer covers
+ * @color: Base color of the effect on every zone
+ */
+struct animation_layer {
+	enum animation_mode mode;
+	enum animation_blend blend;
+	u8 alpha;
+	u8 zone_mask;
+	struct color_platform color;
+};
+
+/**
+ * struct render_state - Everything a rendered frame depends on
+ * @mode: Selected animation
+ * @speed: Animation speed multiplier
+ * @active: Frame clock running
+ * @brightness: Output brightness in percent
+ * @colors: User-set zone colors, the base of every effect
+ * @layer_count: Number of entries in @layers
+ * @layers: Layer stack over the base animation, bottom first
+ * @fade_from: Frame shown when the last mode change started
+ * @fade_start_ns: Time of the last mode change
+ * @fade_ns: Crossfade length of the last mode change, 0 for none
+ * @phase_base_ns: Effect time (ns at speed 1) at @phase_anchor_ns
+ * @phase_anchor_ns: Time of the last clock start or speed change
+ */
+struct render_state {
+	enum animation_mode mode;
+	int speed;
+	bool active;
+	int brightness;
+	struct color_platform colors[ZONE_COUNT];
+	u8 layer_count;
+	struct animation_layer layers[ANIMATION_MAX_LAYERS];
+	struct color_platform fade_from[ZONE_COUNT];
+	u64 fade_start_ns;
+	u64 fade_ns;
+	u64 phase_base_ns;
+	u64 phase_anchor_ns;
+};
 
 /* Device attributes for sysfs */
 extern struct device_attribute animation_brightness_attr;
 extern struct device_attribute animation_mode_attr;
 extern struct device_attribute animation_speed_attr;
 extern struct device_attribute gradient_config_attr;
+extern struct device_attribute animation_fps_attr;
+extern struct device_attribute animation_fps_current_attr;
+extern struct device_attribute render_stats_attr;
+extern struct device_attribute animation_layers_attr;
+extern struct device_attribute animation_transition_attr;
 
 /**
  * animation_init - Initialize animation system
+ *
+ * Sets up the frame clock and the render workqueue.
+ *
+ * Returns: 0 on success, error code otherwise
  */
-void animation_init(void);
+int animation_init(void);
+
+/**
+ * render_state_read - Take a consistent snapshot of the render state
+ * @rs: Output
+ *
+ * Lock-free and never waits for a writer: returns the state as of the
+ * last render_state_write_end().
+ */
+void render_state_read(struct render_state *rs);
+
+/**
+ * render_state_lock - Serialize a render state update
+ *
+ * Held across the whole update, including animation_start() and
+ * animation_stop(), so concurrent sysfs writers cannot interleave.
+ */
+void render_state_lock(void);
+
+/**
+ * render_state_unlock - End a render state update
+ */
+void render_state_unlock(void);
+
+/**
+ * render_state_write_begin - Open a write section
+ *
+ * Caller must hold render_state_lock(). Readers see none of the changes
+ * until render_state_write_end().
+ *
+ * Returns: The render state to modify
+ */
+struct render_state *render_state_write_begin(void);
+
+/**
+ * render_state_write_end - Publish the changes of a write section
+ */
+void render_state_write_end(void);
 
 /**
  * animation_cleanup - Clean up animation resources
@@ -77,20 +178,147 @@ void animation_cleanup(void);
 
 /**
  * animation_start - Start currently selected animation
+ *
+ * Caller must hold render_state_lock().
  */
 void animation_start(void);
 
 /**
  * animation_stop - Stop current animation
+ *
+ * Caller must hold render_state_lock().
  */
 void animation_stop(void);
 
+/**
+ * animation_queue_work - Run work on the render workqueue
+ * @work: Work item
+ *
+ * For other frame sources; the workqueue is ordered, so @work never
+ * overlaps an animation frame.
+ *
+ * Returns: false if @work was already pending
+ */
+bool animation_queue_work(struct work_struct *work);
+
+/**
+ * animation_transition - Switch the base animation mode
+ * @mode: New mode
+ *
+ * Crossfades from the frame shown now into @mode over transition_ms,
+ * starting the frame clock if needed. Caller must hold
+ * render_state_lock().
+ */
+void animation_transition(enum animation_mode mode);
+
+/**
+ * animation_set_speed - Change the speed of the running effect
+ * @speed: New speed
+ *
+ * Rebases the effect phase so motion continues seamlessly. Caller must
+ * hold render_state_lock().
+ */
+void animation_set_speed(int speed);
+
+/**
+ * animation_rebase_speed - Change the speed inside a write section
+ * @rs: Render state from render_state_write_begin()
+ * @speed: New speed
+ *
+ * What animation_set_speed() does, for updates that change more than the
+ * speed in one write section.
+ */
+void animation_rebase_speed(struct render_state *rs, int speed);
+
+/**
+ * animation_fade_to - Select a mode inside a write section
+ * @rs: Render state from render_state_write_begin()
+ * @mode: New animation mode
+ * @from: Frame shown now, from fourzone_shown_frame()
+ *
+ * Sets up the crossfade animation_transition() would. Call
+ * animation_update() after render_state_write_end().
+ */
+void animation_fade_to(struct render_state *rs, enum animation_mode mode,
+		       const struct color_platform *from);
+
+/**
+ * animation_update - Start or commit what a mode change needs
+ *
+ * Starts the frame clock if the render state animates, or commits the
+ * static frame if the clock is stopped. A running clock picks the change
+ * up by itself. Caller must hold render_state_lock().
+ */
+void animation_update(void);
+
+/**
+ * animation_halt - Stop the frame clock without restoring static colors
+ *
+ * For callers that commit new colors right after. Caller must hold
+ * render_state_lock().
+ */
+void animation_halt(void);
+
+/**
+ * animation_hold - Hand the output to another frame source, or take it back
+ * @hold: true to hand it over
+ *
+ * Holding halts the frame clock. Until it is released, animation_start()
+ * and static color commits only leave their changes in the render state,
+ * so sysfs writers cannot draw over the other source. Caller must hold
+ * render_state_lock().
+ */
+void animation_hold(bool hold);
+
+/**
+ * animation_held - Whether another frame source owns the output
+ *
+ * Returns: true between animation_hold(true) and animation_hold(false)
+ */
+bool animation_held(void);
+
+/**
+ * animation_compose_static - Composite the static part of a frame
+ * @rs: Render state snapshot
+ * @colors: Output frame
+ *
+ * Base zone colors with every static layer blended on top; what the
+ * keyboard shows while the frame clock is stopped.
+ */
+void animation_compose_static(const struct render_state *rs,
+			      struct color_platform *colors);
+
+/**
+ * animation_mode_parse - Look up an animation mode by name
+ * @name: Mode name, trailing newline allowed
+ *
+ * Returns: The animation mode, -EINVAL for unknown names
+ */
+int animation_mode_parse(const char *name);
+
+/**
+ * animation_mode_name - Name of an animation mode
+ * @mode: Animation mode
+ *
+ * Returns: The name as accepted by animation_mode_parse(), or "unknown"
+ */
+const char *animation_mode_name(enum animation_mode mode);
+
 /**
  * animation_set_mode - Set animation mode
  * @mode: New animation mode
+ *
+ * Caller must hold render_state_lock().
  */
 void animation_set_mode(enum animation_mode mode);
 
+/**
+ * animation_running - Whether the frame clock is running
+ *
+ * Returns: true while frames are being rendered
+ */
+bool animation_running(void);
+
 /**
  * animation_get_mode - Get current animation mode
  *
@@ -98,6 +326,23 @@ void animation_set_mode(enum animation_mode mode);
  */
 enum animation_mode animation_get_mode(void);
 
+/**
+ * gradient_config_get - Copy the current gradient configuration
+ * @cfg: Output; all zero when no gradient was configured
+ */
+void gradient_config_get(struct gradient_config *cfg);
+
+/**
+ * gradient_config_publish - Replace the gradient configuration
+ * @cfg: Validated configuration
+ *
+ * Precomputes the per-group transition steps into a new object and
+ * publishes it with RCU; the previous one is freed after a grace period.
+ *
+ * Returns: 0 on success, -ENOMEM otherwise
+ */
+int gradient_config_publish(const struct gradient_config *cfg);
+
 /**
  * hsv_to_rgb - Convert HSV color to RGB
  * @h: Hue (0-360)
@@ -11,31 +11,88 @@
 #define OMEN_STATE_H
 
 #include <linux/types.h>
+#include <linux/device.h>
+#include <linux/sysfs.h>
 #include "omen_zones.h"
 #include "omen_animations.h"
 
-#define STATE_FILE_PATH "/var/lib/omen-rgb-keyboard/state"
+/* "OMEN", little-endian */
+#define OMEN_STATE_MAGIC	0x4e454d4f
+#define OMEN_STATE_VERSION	2
 
-struct animation_state {
-	enum animation_mode mode;
-	int speed;
-	int brightness;
+#define OMEN_PROFILE_MAX	8
+#define OMEN_PROFILE_NAME_LEN	16
+
+/*
+ * Settings of one profile. Fields may only be appended: older records
+ * are zero-extended and longer ones truncated on load.
+ */
+struct omen_profile_settings {
+	s32 mode;		/* enum animation_mode */
+	s32 speed;
+	s32 brightness;
 	struct color_platform colors[ZONE_COUNT];
 	struct gradient_config gradient;
 };
 
+struct omen_profile_record {
+	char name[OMEN_PROFILE_NAME_LEN];	/* NUL-padded */
+	struct omen_profile_settings settings;
+};
+
+/* Smallest record a version 2 writer can produce */
+#define OMEN_PROFILE_RECORD_MIN \
+	offsetofend(struct omen_profile_record, settings.gradient)
+
+/*
+ * Binary layout of the rgb_zones/state attribute: this header followed
+ * by profile_count records of record_size bytes. Userspace stores it
+ * as-is and writes it back to restore; the driver does no file I/O.
+ */
+struct omen_state_header {
+	u32 magic;
+	u16 version;
+	u16 size;		/* header and all records */
+	u32 crc;		/* crc32 of the records */
+	u16 record_size;
+	u8 profile_count;
+	u8 active;		/* index of the active profile */
+};
+
+/* rgb_zones/state: read the profile store, write a saved one back */
+extern const struct bin_attribute omen_state_bin_attr;
+
+/* rgb_zones/profile: list, switch, create and delete profiles */
+extern struct device_attribute omen_profile_attr;
+
 /**
- * save_animation_state - Save current animation state to disk
+ * save_animation_state - Announce that the state changed
  *
- * Note: Directory /var/lib/omen-rgb-keyboard is created by install.sh
- * We don't create it here to avoid kernel API compatibility issues
+ * Once no further change arrived for save_delay_ms, and only if the
+ * serialized state differs from the last announced one, polls on
+ * rgb_zones/state are woken and a change uevent with
+ * OMEN_RGB_STATE=changed is sent so userspace can save the blob.
  */
 void save_animation_state(void);
 
 /**
- * load_animation_state - Load saved animation state from disk
+ * omen_state_flush - Send a pending change notification now
  */
-void load_animation_state(void);
+void omen_state_flush(void);
 
-#endif /* OMEN_STATE_H */
+/**
+ * omen_state_init - Enable change notifications
+ * @dev: Device carrying the rgb_zones group
+ *
+ * Also flushes pending notifications before suspend and hibernation.
+ *
+ * Returns: 0 on success, negative error code on failure
+ */
+int omen_state_init(struct device *dev);
 
+/**
+ * omen_state_cleanup - Flush a pending notification and disable them
+ */
+void omen_state_cleanup(void);
+
+#endif /* OMEN_STATE_H */
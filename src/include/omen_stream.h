@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: GPL-3
+/*
+ * HP OMEN RGB Keyboard Driver - Frame Streaming
+ *
+ * /dev/omen-rgb: userspace-rendered frames through an mmap'd ring
+ *
+ * Author: alessandromrc
+ */
+
+#ifndef OMEN_STREAM_H
+#define OMEN_STREAM_H
+
+/**
+ * omen_stream_setup - Register the /dev/omen-rgb misc device
+ *
+ * Returns: 0 on success, negative error code on failure
+ */
+int omen_stream_setup(void);
+
+/**
+ * omen_stream_cleanup - Unregister the device and free the ring
+ */
+void omen_stream_cleanup(void);
+
+#endif /* OMEN_STREAM_H */
@@ -11,6 +11,7 @@
 #define OMEN_WMI_H
 
 #include <linux/types.h>
+#include <linux/acpi.h>
 
 #define HPWMI_BIOS_GUID "5FB7F034-2C63-45e9-BE91-3D44E2C707E4"
 #define HPWMI_EVENT_GUID "95F24279-4D7B-4334-9387-ACCDC67EF61C"
@@ -64,6 +65,120 @@ enum hp_return_value {
 	HPWMI_RET_INVALID_PARAMETERS = 0x05,
 };
 
+/**
+ * enum hp_wmi_prio - BIOS command arbiter priority, lowest first
+ * @HPWMI_PRIO_LIGHTING: Cosmetic lighting frames
+ * @HPWMI_PRIO_NORMAL: Sysfs reads and writes, probing, setup
+ * @HPWMI_PRIO_FAN: Fan safety commands (max-fan keepalive, curve applies)
+ * @HPWMI_PRIO_COUNT: Number of priorities
+ */
+enum hp_wmi_prio {
+	HPWMI_PRIO_LIGHTING,
+	HPWMI_PRIO_NORMAL,
+	HPWMI_PRIO_FAN,
+	HPWMI_PRIO_COUNT
+};
+
+/**
+ * enum hp_wmi_cap - BIOS capabilities found by hp_wmi_caps_probe()
+ * @HPWMI_CAP_PLATFORM_INFO: Lighting platform info (HPWMI_GET_PLATFORM_INFO)
+ * @HPWMI_CAP_SYSTEM_DESIGN_DATA: HPWMI_GM_GET_SYSTEM_DESIGN_DATA
+ * @HPWMI_CAP_FAN_SPEED: Classic fan speed read (HPWMI_GM_FAN_SPEED_GET)
+ * @HPWMI_CAP_FAN_MAX: Max-fan state read (HPWMI_GM_FAN_SPEED_MAX_GET)
+ * @HPWMI_CAP_VICTUS_FAN_SPEED: Victus-S fan speeds (HPWMI_GM_VICTUS_FAN_SPEED_GET)
+ * @HPWMI_CAP_COUNT: Number of capabilities
+ */
+enum hp_wmi_cap {
+	HPWMI_CAP_PLATFORM_INFO,
+	HPWMI_CAP_SYSTEM_DESIGN_DATA,
+	HPWMI_CAP_FAN_SPEED,
+	HPWMI_CAP_FAN_MAX,
+	HPWMI_CAP_VICTUS_FAN_SPEED,
+	HPWMI_CAP_COUNT
+};
+
+/**
+ * struct hp_wmi_arb_stats - Arbiter wait statistics for one priority
+ * @grants: Times the BIOS method was granted
+ * @total_wait_ns: Time spent waiting for grants
+ * @max_wait_ns: Longest single wait
+ */
+struct hp_wmi_arb_stats {
+	u64 grants;
+	u64 total_wait_ns;
+	u64 max_wait_ns;
+};
+
+/**
+ * struct hp_wmi_transport - Backend used to reach the HP BIOS WMI method
+ * @name: Backend name, as accepted by the "transport" module parameter
+ * @init: Optional one-time setup, called before the first query
+ * @evaluate: Evaluate the BIOS method; same contract as wmi_evaluate_method()
+ *            for HPWMI_BIOS_GUID instance 0 (including ACPI_ALLOCATE_BUFFER)
+ * @ec_read: Read an embedded controller register
+ * @has_events: Whether HPWMI_EVENT_GUID notifications are delivered
+ */
+struct hp_wmi_transport {
+	const char *name;
+	int (*init)(void);
+	acpi_status (*evaluate)(u32 method_id, const struct acpi_buffer *in,
+				struct acpi_buffer *out);
+	int (*ec_read)(u8 addr, u8 *val);
+	bool has_events;
+};
+
+/* In-memory BIOS model, see wmi/omen_wmi_sim.c */
+extern const struct hp_wmi_transport hp_wmi_sim_transport;
+
+/**
+ * hp_wmi_transport_init - Select and initialize the WMI transport
+ *
+ * Returns: 0 on success, error code otherwise
+ */
+int hp_wmi_transport_init(void);
+
+/**
+ * hp_wmi_transport_has_bios - Check that the selected transport can talk to BIOS
+ *
+ * Returns: true for the simulator or when HPWMI_BIOS_GUID is present
+ */
+bool hp_wmi_transport_has_bios(void);
+
+/**
+ * hp_wmi_transport_name - Name of the selected WMI transport
+ */
+const char *hp_wmi_transport_name(void);
+
+/**
+ * hp_wmi_caps_probe - Query the BIOS capabilities once
+ *
+ * Records which commands succeed and which the BIOS reports as
+ * HPWMI_RET_UNKNOWN_COMMAND/UNKNOWN_CMDTYPE. Skipped when the wmi_caps
+ * parameter carries a bitmap for this board. Must run after
+ * hp_wmi_transport_init() and before any hp_wmi_has_cap() caller.
+ */
+void hp_wmi_caps_probe(void);
+
+/**
+ * hp_wmi_has_cap - Check a cached BIOS capability
+ * @cap: Capability to test
+ *
+ * Returns: true if the BIOS answered the capability's query
+ */
+bool hp_wmi_has_cap(enum hp_wmi_cap cap);
+
+/* capabilities attribute of the platform device */
+extern struct device_attribute hp_wmi_caps_attr;
+
+/**
+ * hp_wmi_ec_read - Read an EC register through the selected transport
+ * @addr: EC register offset
+ * @val: Output value
+ *
+ * Returns: 0 on success, error code otherwise
+ */
+int hp_wmi_ec_read(u8 addr, u8 *val);
+
 /**
  * hp_wmi_perform_query - Execute WMI query to HP BIOS
  * @query: Query type (hp_wmi_commandtype)
@@ -77,6 +192,106 @@ enum hp_return_value {
 int hp_wmi_perform_query(int query, enum hp_wmi_command command,
 			 void *buffer, int insize, int outsize);
 
+/**
+ * hp_wmi_perform_query_prio - hp_wmi_perform_query() at a given priority
+ * @prio: Arbiter priority of the command
+ * @query: Query type (hp_wmi_commandtype)
+ * @command: Command type (hp_wmi_command)
+ * @buffer: Input/output buffer
+ * @insize: Size of input data
+ * @outsize: Expected output size
+ *
+ * All BIOS calls are serialized by one arbiter. A call waits for the one
+ * in flight and for every waiting call of higher priority. May sleep.
+ *
+ * Returns: 0 on success, error code otherwise
+ */
+int hp_wmi_perform_query_prio(enum hp_wmi_prio prio, int query,
+			      enum hp_wmi_command command,
+			      void *buffer, int insize, int outsize);
+
+/**
+ * hp_wmi_arb_stats_get - Snapshot arbiter wait statistics
+ * @prio: Priority to read
+ * @out: Output statistics
+ */
+void hp_wmi_arb_stats_get(enum hp_wmi_prio prio, struct hp_wmi_arb_stats *out);
+
+/**
+ * hp_wmi_arb_stats_reset - Clear arbiter wait statistics
+ */
+void hp_wmi_arb_stats_reset(void);
+
+struct hp_wmi_ctx;
+
+/**
+ * hp_wmi_ctx_alloc - Allocate a preallocated query context for a hot path
+ * @max_outsize: Largest outsize the context will be used with
+ * @prio: Arbiter priority of every query issued through the context
+ *
+ * The context owns a bios_args block and an ACPI output buffer sized for
+ * the encode_outsize_for_pvsz() bucket of @max_outsize. Callers must
+ * serialize use of one context.
+ *
+ * Returns: context on success, NULL on allocation failure
+ */
+struct hp_wmi_ctx *hp_wmi_ctx_alloc(int max_outsize, enum hp_wmi_prio prio);
+
+/**
+ * hp_wmi_ctx_free - Free a query context
+ * @ctx: Context from hp_wmi_ctx_alloc(), may be NULL
+ */
+void hp_wmi_ctx_free(struct hp_wmi_ctx *ctx);
+
+/**
+ * hp_wmi_perform_query_ctx - hp_wmi_perform_query() without allocations
+ * @ctx: Preallocated context, NULL falls back to hp_wmi_perform_query()
+ * @query: Query type (hp_wmi_commandtype)
+ * @command: Command type (hp_wmi_command)
+ * @buffer: Input/output buffer
+ * @insize: Size of input data
+ * @outsize: Expected output size
+ *
+ * Only for idempotent commands: if the BIOS reply overflows the context
+ * buffer it is grown and the method evaluated again.
+ *
+ * Returns: 0 on success, error code otherwise
+ */
+int hp_wmi_perform_query_ctx(struct hp_wmi_ctx *ctx, int query,
+			     enum hp_wmi_command command,
+			     void *buffer, int insize, int outsize);
+
+/**
+ * hp_wmi_stats_count_alloc - Account one ACPI result buffer allocation
+ */
+void hp_wmi_stats_count_alloc(void);
+
+/**
+ * hp_wmi_stats_record - Account one BIOS call in the debugfs statistics
+ * @command: Command (hp_wmi_command)
+ * @query: Query type (commandtype)
+ * @ret: Result of the call (0, hp_return_value or negative errno)
+ * @ns: Time spent in the transport
+ */
+void hp_wmi_stats_record(u32 command, u32 query, int ret, u64 ns);
+
+/**
+ * hp_wmi_debugfs_init - Create debugfs statistics files
+ * Returns: 0 on success, error code otherwise
+ */
+int hp_wmi_debugfs_init(void);
+
+/**
+ * hp_wmi_debugfs_root - Driver debugfs directory for other diagnostics
+ * Returns: the directory, or an error/NULL pointer debugfs functions accept
+ */
+struct dentry *hp_wmi_debugfs_root(void);
+
+/**
+ * hp_wmi_debugfs_cleanup - Remove debugfs files and free statistics
+ */
+void hp_wmi_debugfs_cleanup(void);
+
 /**
  * hp_wmi_input_setup - Initialize input device for key events
  * Returns: 0 on success, error code otherwise
@@ -18,6 +18,7 @@
 #include "omen_wmi.h"
 
 #define ZONE_COUNT 4
+#define FOURZONE_STATE_SIZE 128
 
 struct color_platform {
 	u8 blue;
@@ -33,8 +34,6 @@ struct platform_zone {
 
 /* Global zone data */
 extern struct platform_zone *zone_data;
-extern struct platform_zone original_colors[ZONE_COUNT];
-extern int global_brightness;
 extern struct led_classdev omen_kbd_led;
 
 /**
@@ -47,13 +46,30 @@ extern struct led_classdev omen_kbd_led;
 int parse_rgb(const char *buf, struct platform_zone *zone);
 
 /**
- * fourzone_update_led - Update or read LED color for a zone
- * @zone: Target zone
- * @rw: HPWMI_READ or HPWMI_WRITE
+ * fourzone_read_zone - Read the current LED color of a zone
+ * @zone: Target zone, colors are filled in
+ *
+ * Served from the shadow lighting buffer, which is loaded from the BIOS
+ * first if it is stale. Writes go through fourzone_commit_frame().
+ *
+ * Returns: 0 on success, error code otherwise
+ */
+int fourzone_read_zone(struct platform_zone *zone);
+
+/**
+ * fourzone_shadow_invalidate - Mark the cached lighting buffer as stale
+ *
+ * The next zone access re-reads the state from BIOS. Safe to call from
+ * any context (resume, WMI event handler).
+ */
+void fourzone_shadow_invalidate(void);
+
+/**
+ * fourzone_shadow_resync - Re-read the cached lighting buffer from BIOS now
  *
  * Returns: 0 on success, error code otherwise
  */
-int fourzone_update_led(struct platform_zone *zone, enum hp_wmi_command rw);
+int fourzone_shadow_resync(void);
 
 /**
  * match_zone - Find zone matching a device attribute
@@ -64,16 +80,58 @@ int fourzone_update_led(struct platform_zone *zone, enum hp_wmi_command rw);
 struct platform_zone *match_zone(struct device_attribute *attr);
 
 /**
- * apply_brightness_to_color - Apply global brightness to a color
- * @color: Color to modify
+ * fourzone_commit_frame - Write all zone colors with a single BIOS call
+ * @colors: Final (brightness-applied) colors for all zones
+ *
+ * Patches every zone into one copy of the lighting buffer and issues
+ * exactly one HPWMI_FOURZONE_COLOR_SET, so all zones change together.
+ * Frames published while another commit is in flight are coalesced: only
+ * the newest one is sent and callers of overtaken frames return 0.
+ *
+ * Returns: 0 on success, error code otherwise
  */
-void apply_brightness_to_color(struct color_platform *color);
+int fourzone_commit_frame(const struct color_platform colors[ZONE_COUNT]);
+
+/**
+ * fourzone_shown_frame - Last frame committed to the keyboard
+ * @colors: Output, zone colors before brightness and gamma
+ */
+void fourzone_shown_frame(struct color_platform colors[ZONE_COUNT]);
 
 /**
  * update_all_zones_with_colors - Update all zones with new colors
  * @colors: Array of colors for all zones
+ *
+ * Applies global brightness and commits the frame in one BIOS call.
+ *
+ * Returns: 0 on success, error code otherwise
  */
-void update_all_zones_with_colors(struct color_platform colors[ZONE_COUNT]);
+int update_all_zones_with_colors(struct color_platform colors[ZONE_COUNT]);
+
+/**
+ * update_all_zones_with_original_colors - Restore the static zone colors
+ *
+ * Does nothing while animation_held().
+ *
+ * Returns: 0 on success, error code otherwise
+ */
+int update_all_zones_with_original_colors(void);
+
+/**
+ * fourzone_apply_theme - Change colors, brightness, mode and speed at once
+ * @colors: New zone colors, used for the zones in @zones
+ * @zones: Bitmask of zones to take from @colors
+ * @brightness: 0-100, or -1 to keep
+ * @mode: New animation mode, or -1 to keep
+ * @speed: New animation speed, or -1 to keep
+ *
+ * Values must be validated. Applies everything with one BIOS commit and
+ * schedules one state save.
+ *
+ * Returns: 0 on success, error code otherwise
+ */
+int fourzone_apply_theme(const struct color_platform colors[ZONE_COUNT],
+			 unsigned int zones, int brightness, int mode, int speed);
 
 /* Sysfs attribute callbacks */
 ssize_t zone_show(struct device *dev, struct device_attribute *attr, char *buf);
@@ -99,6 +157,15 @@ int omen_kbd_brightness_set(struct led_classdev *led_cdev,
  */
 int fourzone_setup(struct platform_device *dev);
 
+/**
+ * fourzone_remove_sysfs - Remove the rgb_zones attributes
+ *
+ * Called first on unload so no store can restart the frame clock or
+ * queue work while the animation and state code is torn down. Safe to
+ * call more than once.
+ */
+void fourzone_remove_sysfs(void);
+
 /**
  * fourzone_cleanup - Clean up zone management resources
  */
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: GPL-3 WITH Linux-syscall-note */
+/*
+ * HP OMEN RGB Keyboard Driver - Frame Streaming Interface
+ *
+ * Userspace ABI of /dev/omen-rgb: an mmap'd ring of packed RGB frames
+ * and a doorbell. Shared by the driver and userspace producers.
+ *
+ * Producer protocol:
+ *   1. mmap() the device, OMEN_RGB_RING_SIZE bytes at offset 0
+ *   2. fill frames[head % slots]
+ *   3. store head + 1 to head with release semantics
+ *   4. ring the doorbell: write() of any length or OMEN_RGB_IOC_KICK
+ *
+ * The driver commits only the newest published frame; frames published
+ * in between are counted in skipped. tail is the head value of the last
+ * committed frame. A producer must not run more than slots - 1 frames
+ * ahead of tail, or the frame being read may be overwritten; the driver
+ * detects that, retries a few times and then drops the frame until the
+ * next doorbell.
+ *
+ * Author: alessandromrc
+ */
+
+#ifndef _UAPI_OMEN_RGB_H
+#define _UAPI_OMEN_RGB_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define OMEN_RGB_RING_VERSION	1
+#define OMEN_RGB_RING_SLOTS	64
+#define OMEN_RGB_FRAME_ZONES	4
+
+/* One frame: zone 0..3, red, green, blue */
+struct omen_rgb_frame {
+	__u8 rgb[OMEN_RGB_FRAME_ZONES][3];
+};
+
+struct omen_rgb_ring {
+	__u32 version;		/* OMEN_RGB_RING_VERSION, set by the driver */
+	__u32 slots;		/* OMEN_RGB_RING_SLOTS, set by the driver */
+	__u32 zones;		/* OMEN_RGB_FRAME_ZONES, set by the driver */
+	__u32 head;		/* written by the producer */
+	__u32 tail;		/* written by the driver */
+	__u32 skipped;		/* written by the driver */
+	__u32 reserved[10];
+	struct omen_rgb_frame frames[OMEN_RGB_RING_SLOTS];
+};
+
+/* Bytes to mmap(); the ring is rounded up to whole pages */
+#define OMEN_RGB_RING_SIZE	4096
+
+#define OMEN_RGB_IOC_MAGIC	'O'
+#define OMEN_RGB_IOC_KICK	_IO(OMEN_RGB_IOC_MAGIC, 0x01)
+
+#endif /* _UAPI_OMEN_RGB_H */
@@ -10,115 +10,461 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/kernel.h>
-#include <linux/fs.h>
-#include <linux/uaccess.h>
+#include <linux/module.h>
+#include <linux/crc32.h>
+#include <linux/ctype.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/suspend.h>
+#include <linux/sysfs.h>
+#include <linux/workqueue.h>
 
 #include "omen_state.h"
 #include "omen_zones.h"
 #include "omen_animations.h"
 
-void save_animation_state(void)
+static unsigned int save_delay_ms = 1000;
+module_param(save_delay_ms, uint, 0644);
+MODULE_PARM_DESC(save_delay_ms, "Quiet period before a state change is announced for saving");
+
+/*
+ * Device changes are announced on; NULL once unloading. Checked and the
+ * notify work queued under state_dev_lock, so nothing re-arms the work
+ * after omen_state_cleanup() has closed it.
+ */
+static DEFINE_SPINLOCK(state_dev_lock);
+static struct device *state_dev;
+
+struct omen_profile {
+	char name[OMEN_PROFILE_NAME_LEN];
+	struct omen_profile_settings settings;
+};
+
+/*
+ * Profiles are parsed once when the store is written and kept here;
+ * switching applies one of them. The active profile is the only one
+ * that follows the live settings and is captured before it is left or
+ * serialized.
+ */
+static DEFINE_MUTEX(profile_mutex);
+static struct omen_profile profiles[OMEN_PROFILE_MAX] = {
+	{ .name = "default" },
+};
+static unsigned int profile_count = 1;
+static struct omen_profile *active_profile = &profiles[0];
+
+#define STATE_BLOB_MAX \
+	(sizeof(struct omen_state_header) + \
+	 OMEN_PROFILE_MAX * sizeof(struct omen_profile_record))
+
+/* Serialized store; protected by profile_mutex */
+static u8 state_blob[STATE_BLOB_MAX];
+
+/* CRC of the last announced store; only touched by the notify work */
+static u32 state_saved_crc;
+static bool state_saved_valid;
+
+static void state_notify_work_func(struct work_struct *work);
+static DECLARE_DELAYED_WORK(state_notify_work, state_notify_work_func);
+
+static void profile_capture(struct omen_profile_settings *settings)
 {
-	struct file *fp;
-	struct animation_state state;
-	loff_t pos = 0;
-	
-	/* Prepare state data */
-	state.mode = current_animation;
-	state.speed = animation_speed;
-	state.brightness = global_brightness;
-	
-	/* Copy current colors */
-	for (int i = 0; i < ZONE_COUNT; i++) {
-		state.colors[i] = original_colors[i].colors;
+	struct render_state rs;
+
+	/* Zeroed so padding does not change the CRC or leak to userspace */
+	memset(settings, 0, sizeof(*settings));
+
+	render_state_read(&rs);
+	settings->mode = rs.mode;
+	settings->speed = rs.speed;
+	settings->brightness = rs.brightness;
+	for (int i = 0; i < ZONE_COUNT; i++)
+		settings->colors[i] = rs.colors[i];
+
+	gradient_config_get(&settings->gradient);
+}
+
+static int profile_apply(const struct omen_profile_settings *settings)
+{
+	int ret;
+
+	/* Published first, so a transition into gradient uses it */
+	ret = gradient_config_publish(&settings->gradient);
+	if (ret)
+		return ret;
+
+	return fourzone_apply_theme(settings->colors, BIT(ZONE_COUNT) - 1,
+				    settings->brightness, settings->mode,
+				    settings->speed);
+}
+
+static int profile_validate(const struct omen_profile_settings *settings)
+{
+	if (settings->mode < 0 || settings->mode >= ANIMATION_COUNT ||
+	    settings->speed < ANIMATION_SPEED_MIN || settings->speed > ANIMATION_SPEED_MAX ||
+	    settings->brightness < 0 || settings->brightness > 100)
+		return -EINVAL;
+
+	if (settings->gradient.group_count > GRADIENT_MAX_GROUPS)
+		return -EINVAL;
+	for (int i = 0; i < settings->gradient.group_count; i++) {
+		if (settings->gradient.groups[i].color_count > GRADIENT_MAX_COLORS)
+			return -EINVAL;
 	}
 
-	/* Copy gradient config */
-	mutex_lock(&gradient_cfg_mutex);
-	state.gradient = gradient_cfg;
-	mutex_unlock(&gradient_cfg_mutex);
-	
-	/* 
-	 * Note: Directory /var/lib/omen-rgb-keyboard is created by install.sh
-	 * We don't create it here to avoid kernel API compatibility issues
-	 */
-	
-	/* Open file for writing */
-	fp = filp_open(STATE_FILE_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	if (IS_ERR(fp)) {
-		pr_warn("Failed to save animation state: %ld\n", PTR_ERR(fp));
-		return;
+	return 0;
+}
+
+static bool profile_name_valid(const char *name)
+{
+	size_t len = strnlen(name, OMEN_PROFILE_NAME_LEN);
+
+	if (!len || len == OMEN_PROFILE_NAME_LEN)
+		return false;
+	for (size_t i = 0; i < len; i++) {
+		if (!isalnum(name[i]) && name[i] != '-' && name[i] != '_')
+			return false;
 	}
-	
-	/* Write state to file */
-	kernel_write(fp, &state, sizeof(state), &pos);
-	
-	filp_close(fp, NULL);
-	
-	pr_info("Animation state saved\n");
+	return true;
 }
 
-void load_animation_state(void)
+static struct omen_profile *profile_find(const char *name)
 {
-	struct file *fp;
-	struct animation_state state;
-	loff_t pos = 0;
-	ssize_t ret;
-	
-	/* Open file for reading */
-	fp = filp_open(STATE_FILE_PATH, O_RDONLY, 0);
-	if (IS_ERR(fp)) {
-		pr_info("No saved animation state found\n");
-		return;
+	for (unsigned int i = 0; i < profile_count; i++) {
+		if (!strcmp(profiles[i].name, name))
+			return &profiles[i];
 	}
-	
-	/* Read state from file */
-	ret = kernel_read(fp, &state, sizeof(state), &pos);
-	if (ret != sizeof(state)) {
-		pr_warn("Failed to read animation state\n");
-		filp_close(fp, NULL);
+	return NULL;
+}
+
+/* Caller holds profile_mutex; returns the blob length */
+static size_t state_serialize(void)
+{
+	struct omen_state_header *hdr = (void *)state_blob;
+	struct omen_profile_record *rec = (void *)(hdr + 1);
+	size_t len = sizeof(*hdr) + profile_count * sizeof(*rec);
+
+	profile_capture(&active_profile->settings);
+
+	memset(state_blob, 0, len);
+	for (unsigned int i = 0; i < profile_count; i++) {
+		memcpy(rec[i].name, profiles[i].name, sizeof(rec[i].name));
+		rec[i].settings = profiles[i].settings;
+	}
+
+	hdr->magic = OMEN_STATE_MAGIC;
+	hdr->version = OMEN_STATE_VERSION;
+	hdr->size = len;
+	hdr->crc = crc32(0, rec, len - sizeof(*hdr));
+	hdr->record_size = sizeof(*rec);
+	hdr->profile_count = profile_count;
+	hdr->active = active_profile - profiles;
+
+	return len;
+}
+
+/* Tell userspace the store changed - runs from state_notify_work only */
+static void state_notify_work_func(struct work_struct *work)
+{
+	static char *envp[] = { "OMEN_RGB_STATE=changed", NULL };
+	struct device *dev = READ_ONCE(state_dev);
+	size_t len;
+	u32 crc;
+
+	/* omen_state_cleanup() waits for this run before the device goes */
+	if (!dev)
+		return;
+
+	mutex_lock(&profile_mutex);
+	len = state_serialize();
+	crc = crc32(0, state_blob, len);
+	mutex_unlock(&profile_mutex);
+
+	/* Bursts often end where they started, e.g. a slider moved back */
+	if (state_saved_valid && crc == state_saved_crc)
 		return;
+	state_saved_crc = crc;
+	state_saved_valid = true;
+
+	sysfs_notify(&dev->kobj, "rgb_zones", "state");
+	kobject_uevent_env(&dev->kobj, KOBJ_CHANGE, envp);
+}
+
+void save_animation_state(void)
+{
+	/* Every change restarts the quiet period: a burst is announced once */
+	spin_lock(&state_dev_lock);
+	if (state_dev)
+		mod_delayed_work(system_wq, &state_notify_work,
+				 msecs_to_jiffies(READ_ONCE(save_delay_ms)));
+	spin_unlock(&state_dev_lock);
+}
+
+void omen_state_flush(void)
+{
+	/* Runs a pending notification now; no-op if none is pending */
+	flush_delayed_work(&state_notify_work);
+}
+
+/* Settings blob earlier versions saved to /var/lib (version 0) */
+struct omen_state_v0 {
+	s32 mode;
+	s32 speed;
+	s32 brightness;
+	struct color_platform colors[ZONE_COUNT];
+	struct gradient_config gradient;
+};
+
+/* The same behind a magic/version/size header (version 1) */
+struct omen_state_v1 {
+	u32 magic;
+	u16 version;
+	u16 size;
+	struct omen_state_v0 body;
+};
+
+/* Both legacy formats become a single "default" profile */
+static int state_parse_legacy(const char *buf, size_t count,
+			      struct omen_profile *table)
+{
+	const struct omen_state_v1 *v1 = (const void *)buf;
+	const struct omen_state_v0 *v0 = (const void *)buf;
+
+	if (count == sizeof(*v1) && v1->magic == OMEN_STATE_MAGIC) {
+		if (v1->version != 1 || v1->size != sizeof(*v1))
+			return -EINVAL;
+		v0 = &v1->body;
+	} else if (count != sizeof(*v0)) {
+		return -EINVAL;
 	}
-	
-	filp_close(fp, NULL);
-	
-	if (state.mode >= 0 && state.mode < ANIMATION_COUNT) {
-		current_animation = state.mode;
+
+	BUILD_BUG_ON(sizeof(*v0) != sizeof(table[0].settings));
+	strscpy(table[0].name, "default", sizeof(table[0].name));
+	memcpy(&table[0].settings, v0, sizeof(*v0));
+	return 1;
+}
+
+/* Returns the number of profiles parsed into @table */
+static int state_parse(const char *buf, size_t count, struct omen_profile *table,
+		       unsigned int *active)
+{
+	const struct omen_state_header *hdr = (const void *)buf;
+	const char *rec;
+	size_t rec_size;
+	int n;
+
+	*active = 0;
+	if (count < sizeof(*hdr) || hdr->magic != OMEN_STATE_MAGIC ||
+	    hdr->version == 1)
+		return state_parse_legacy(buf, count, table);
+	if (hdr->version != OMEN_STATE_VERSION)
+		return -EINVAL;
+
+	n = hdr->profile_count;
+	rec_size = hdr->record_size;
+	if (!n || n > OMEN_PROFILE_MAX || hdr->active >= n ||
+	    rec_size < OMEN_PROFILE_RECORD_MIN ||
+	    hdr->size != count || count != sizeof(*hdr) + n * rec_size)
+		return -EINVAL;
+
+	rec = buf + sizeof(*hdr);
+	if (crc32(0, rec, count - sizeof(*hdr)) != hdr->crc)
+		return -EBADMSG;
+
+	for (int i = 0; i < n; i++, rec += rec_size) {
+		memcpy(&table[i], rec, min(rec_size, sizeof(struct omen_profile_record)));
+		if (!profile_name_valid(table[i].name))
+			return -EINVAL;
+		for (int j = 0; j < i; j++) {
+			if (!strcmp(table[i].name, table[j].name))
+				return -EINVAL;
+		}
 	}
-	if (state.speed >= ANIMATION_SPEED_MIN && state.speed <= ANIMATION_SPEED_MAX) {
-		animation_speed = state.speed;
+
+	*active = hdr->active;
+	return n;
+}
+
+static ssize_t state_read(struct file *filp, struct kobject *kobj,
+			  const struct bin_attribute *attr, char *buf,
+			  loff_t off, size_t count)
+{
+	ssize_t ret;
+
+	mutex_lock(&profile_mutex);
+	ret = memory_read_from_buffer(buf, count, &off, state_blob,
+				      state_serialize());
+	mutex_unlock(&profile_mutex);
+
+	return ret;
+}
+
+/* The whole store in one write; replaces all profiles */
+static ssize_t state_write(struct file *filp, struct kobject *kobj,
+			   const struct bin_attribute *attr, char *buf,
+			   loff_t off, size_t count)
+{
+	struct omen_profile *table;
+	unsigned int active;
+	int n, ret;
+
+	if (off)
+		return -EINVAL;
+
+	/* Zeroed: fields a shorter record lacks read as 0 */
+	table = kcalloc(OMEN_PROFILE_MAX, sizeof(*table), GFP_KERNEL);
+	if (!table)
+		return -ENOMEM;
+
+	n = state_parse(buf, count, table, &active);
+	if (n < 0) {
+		ret = n;
+		goto out;
 	}
-	if (state.brightness >= 0 && state.brightness <= 100) {
-		global_brightness = state.brightness;
+
+	for (int i = 0; i < n; i++) {
+		ret = profile_validate(&table[i].settings);
+		if (ret)
+			goto out;
+	}
+
+	mutex_lock(&profile_mutex);
+	memcpy(profiles, table, n * sizeof(*table));
+	profile_count = n;
+	active_profile = &profiles[active];
+	ret = profile_apply(&active_profile->settings);
+	if (!ret)
+		pr_info("Restored %d profile(s), active: %s\n", n, active_profile->name);
+	mutex_unlock(&profile_mutex);
+	if (!ret)
+		ret = count;
+out:
+	kfree(table);
+	return ret;
+}
+
+const struct bin_attribute omen_state_bin_attr =
+	__BIN_ATTR(state, 0664, state_read, state_write, STATE_BLOB_MAX);
+
+static ssize_t profile_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	int len = 0;
+
+	mutex_lock(&profile_mutex);
+	for (unsigned int i = 0; i < profile_count; i++) {
+		if (&profiles[i] == active_profile)
+			len += sysfs_emit_at(buf, len, "[%s] ", profiles[i].name);
+		else
+			len += sysfs_emit_at(buf, len, "%s ", profiles[i].name);
 	}
-	
-	/* Restore colors */
-	for (int i = 0; i < ZONE_COUNT; i++) {
-		original_colors[i].colors = state.colors[i];
+	mutex_unlock(&profile_mutex);
+
+	/* Replace the trailing space */
+	buf[len - 1] = '\n';
+	return len;
+}
+
+/*
+ * "name" switches to a profile, creating it from the current settings
+ * if it does not exist; "-name" deletes an inactive one.
+ */
+static ssize_t profile_store(struct device *dev, struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	char buf_name[OMEN_PROFILE_NAME_LEN + 1];
+	struct omen_profile *p, *last;
+	char *name;
+	bool delete = false;
+	int ret = 0;
+
+	if (*buf == '-') {
+		delete = true;
+		buf++;
 	}
+	if (strscpy(buf_name, buf, sizeof(buf_name)) < 0)
+		return -EINVAL;
+	name = strim(buf_name);
+	if (!profile_name_valid(name))
+		return -EINVAL;
 
-	/* Restore gradient config (with validation) */
-	if (state.gradient.group_count <= GRADIENT_MAX_GROUPS) {
-		bool gradient_valid = true;
-		for (int i = 0; i < state.gradient.group_count; i++) {
-			if (state.gradient.groups[i].color_count > GRADIENT_MAX_COLORS) {
-				gradient_valid = false;
-				break;
-			}
+	mutex_lock(&profile_mutex);
+	p = profile_find(name);
+
+	if (delete) {
+		if (!p) {
+			ret = -ENOENT;
+		} else if (p == active_profile) {
+			ret = -EBUSY;
+		} else {
+			last = &profiles[--profile_count];
+			if (active_profile == last)
+				active_profile = p;
+			*p = *last;
+			save_animation_state();
 		}
-		if (gradient_valid) {
-			mutex_lock(&gradient_cfg_mutex);
-			gradient_cfg = state.gradient;
-			mutex_unlock(&gradient_cfg_mutex);
+	} else if (!p) {
+		if (profile_count == OMEN_PROFILE_MAX) {
+			ret = -ENOSPC;
 		} else {
-			pr_warn("Saved gradient config has invalid color_count, skipping\n");
+			/* Same settings as now: nothing to commit */
+			p = &profiles[profile_count++];
+			strscpy(p->name, name, sizeof(p->name));
+			profile_capture(&p->settings);
+			active_profile->settings = p->settings;
+			active_profile = p;
+			save_animation_state();
 		}
-	} else {
-		pr_warn("Saved gradient config has invalid group_count %d, skipping\n",
-			state.gradient.group_count);
+	} else if (p != active_profile) {
+		profile_capture(&active_profile->settings);
+		active_profile = p;
+		ret = profile_apply(&p->settings);
 	}
-	
-	pr_info("Animation state loaded: mode=%d, speed=%d, brightness=%d\n", 
-		current_animation, animation_speed, global_brightness);
+	mutex_unlock(&profile_mutex);
+
+	return ret ? ret : count;
 }
 
+struct device_attribute omen_profile_attr = __ATTR(profile, 0664, profile_show, profile_store);
+
+static int state_pm_notify(struct notifier_block *nb, unsigned long action,
+			   void *data)
+{
+	/* Before tasks are frozen, so the save can still run */
+	if (action == PM_SUSPEND_PREPARE || action == PM_HIBERNATION_PREPARE)
+		omen_state_flush();
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block state_pm_nb = {
+	.notifier_call = state_pm_notify,
+};
+
+int omen_state_init(struct device *dev)
+{
+	BUILD_BUG_ON(STATE_BLOB_MAX > PAGE_SIZE);
+
+	spin_lock(&state_dev_lock);
+	state_dev = dev;
+	spin_unlock(&state_dev_lock);
+	return register_pm_notifier(&state_pm_nb);
+}
+
+void omen_state_cleanup(void)
+{
+	unregister_pm_notifier(&state_pm_nb);
+
+	/*
+	 * rgb_zones is gone, but the LED class device can still change
+	 * brightness until the platform device is unregistered. Announce
+	 * what is pending, then close the gate and wait out a run that
+	 * raced with it.
+	 */
+	omen_state_flush();
+	spin_lock(&state_dev_lock);
+	state_dev = NULL;
+	spin_unlock(&state_dev_lock);
+	cancel_delayed_work_sync(&state_notify_work);
+}
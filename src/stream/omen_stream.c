@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPL-3
+/*
+ * HP OMEN RGB Keyboard Driver - Frame Streaming
+ *
+ * /dev/omen-rgb for userspace renderers (visualizers, screen ambience).
+ * Frames are written into an mmap'd ring and committed by the render
+ * workqueue on a doorbell: no parsing, no state file writes and one BIOS
+ * call per frame. See uapi/omen_rgb.h for the producer protocol.
+ *
+ * Author: alessandromrc
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "omen_rgb_keyboard.h"
+#include "omen_zones.h"
+#include "omen_animations.h"
+#include "omen_stream.h"
+#include "uapi/omen_rgb.h"
+
+/* Copies retried when the producer laps the ring, before the frame is dropped */
+#define STREAM_COPY_RETRIES	3
+
+static struct omen_rgb_ring *stream_ring;
+static struct work_struct stream_work;
+
+/* One producer at a time */
+static atomic_t stream_open = ATOMIC_INIT(0);
+
+/* Commit the newest published frame - runs on the render workqueue */
+static void stream_work_func(struct work_struct *work)
+{
+	struct color_platform colors[ZONE_COUNT];
+	const struct omen_rgb_frame *frame;
+	int retries = STREAM_COPY_RETRIES;
+	u32 head, tail;
+	int zone;
+
+	tail = stream_ring->tail;
+retry:
+	head = smp_load_acquire(&stream_ring->head);
+	if (head == tail)
+		return;
+
+	frame = &stream_ring->frames[(head - 1) % OMEN_RGB_RING_SLOTS];
+	for (zone = 0; zone < ZONE_COUNT; zone++) {
+		colors[zone].red = READ_ONCE(frame->rgb[zone][0]);
+		colors[zone].green = READ_ONCE(frame->rgb[zone][1]);
+		colors[zone].blue = READ_ONCE(frame->rgb[zone][2]);
+	}
+
+	/*
+	 * The producer lapped the ring while we copied: the frame may be
+	 * torn. head is written by userspace, so give up after a few tries
+	 * rather than holding the render workqueue.
+	 */
+	if (smp_load_acquire(&stream_ring->head) - head >= OMEN_RGB_RING_SLOTS - 1) {
+		if (retries--)
+			goto retry;
+		WRITE_ONCE(stream_ring->skipped, stream_ring->skipped + 1);
+		return;
+	}
+
+	update_all_zones_with_colors(colors);
+
+	/* head is untrusted; a bogus jump counts as one ring of skips */
+	WRITE_ONCE(stream_ring->skipped, stream_ring->skipped +
+		   min_t(u32, head - tail - 1, OMEN_RGB_RING_SLOTS));
+	smp_store_release(&stream_ring->tail, head);
+}
+
+static int stream_open_dev(struct inode *inode, struct file *file)
+{
+	if (atomic_cmpxchg(&stream_open, 0, 1))
+		return -EBUSY;
+
+	/*
+	 * The producer takes over from any running animation. sysfs changes
+	 * made while the device is open are recorded, not shown.
+	 */
+	render_state_lock();
+	animation_hold(true);
+	render_state_unlock();
+
+	stream_ring->head = 0;
+	stream_ring->tail = 0;
+	stream_ring->skipped = 0;
+
+	return nonseekable_open(inode, file);
+}
+
+static int stream_release(struct inode *inode, struct file *file)
+{
+	cancel_work_sync(&stream_work);
+
+	/* Back to the user's animation, static colors and layers */
+	render_state_lock();
+	animation_hold(false);
+	update_all_zones_with_original_colors();
+	animation_start();
+	render_state_unlock();
+
+	atomic_set(&stream_open, 0);
+	return 0;
+}
+
+static ssize_t stream_write(struct file *file, const char __user *buf,
+			    size_t count, loff_t *ppos)
+{
+	animation_queue_work(&stream_work);
+	return count;
+}
+
+static long stream_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	switch (cmd) {
+	case OMEN_RGB_IOC_KICK:
+		animation_queue_work(&stream_work);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int stream_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff ||
+	    vma->vm_end - vma->vm_start > PAGE_ALIGN(sizeof(*stream_ring)))
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, stream_ring, 0);
+}
+
+static const struct file_operations stream_fops = {
+	.owner = THIS_MODULE,
+	.open = stream_open_dev,
+	.release = stream_release,
+	.write = stream_write,
+	.unlocked_ioctl = stream_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.mmap = stream_mmap,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice stream_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "omen-rgb",
+	.fops = &stream_fops,
+	.mode = 0660,
+};
+
+int omen_stream_setup(void)
+{
+	int ret;
+
+	BUILD_BUG_ON(OMEN_RGB_FRAME_ZONES != ZONE_COUNT);
+	BUILD_BUG_ON(sizeof(struct omen_rgb_ring) > OMEN_RGB_RING_SIZE);
+
+	stream_ring = vmalloc_user(PAGE_ALIGN(sizeof(*stream_ring)));
+	if (!stream_ring)
+		return -ENOMEM;
+
+	stream_ring->version = OMEN_RGB_RING_VERSION;
+	stream_ring->slots = OMEN_RGB_RING_SLOTS;
+	stream_ring->zones = OMEN_RGB_FRAME_ZONES;
+	INIT_WORK(&stream_work, stream_work_func);
+
+	ret = misc_register(&stream_miscdev);
+	if (ret) {
+		vfree(stream_ring);
+		stream_ring = NULL;
+		return ret;
+	}
+
+	return 0;
+}
+
+void omen_stream_cleanup(void)
+{
+	if (!stream_ring)
+		return;
+
+	misc_deregister(&stream_miscdev);
+	cancel_work_sync(&stream_work);
+	vfree(stream_ring);
+	stream_ring = NULL;
+}
@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-3
+/*
+ * Fixed-Point Color Math
+ *
+ * 8-bit color channel math on multiply-shift instead of divides:
+ * scaling by Q16 factors, lerp, alpha blend and HSV to RGB. Header-only
+ * and free of kernel dependencies so the same code can be built and
+ * checked against a floating point reference in userspace.
+ *
+ * Conventions:
+ *   channels, saturation, value, alpha  0..255
+ *   scale factors and lerp positions    Q16, 0..CF_Q16_ONE
+ *   hue                                 0..CF_HUE_MAX-1, 256 steps per
+ *                                       60 degree sector
+ */
+
+#ifndef COLOR_FIXED_H
+#define COLOR_FIXED_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef uint64_t u64;
+typedef int64_t s64;
+#endif
+
+#define CF_Q16_ONE	65536U
+#define CF_HUE_SECTOR	256U
+#define CF_HUE_MAX	(6 * CF_HUE_SECTOR)
+
+/**
+ * cf_div255 - Divide by 255 with rounding
+ * @v: Dividend, at most 255 * 255
+ *
+ * Returns: round(v / 255), exact over the whole input range
+ */
+static inline u8 cf_div255(u32 v)
+{
+	v += 128;
+	return (v + (v >> 8)) >> 8;
+}
+
+/**
+ * cf_mul8 - Multiply two 0..255 quantities as fractions of 255
+ * @a: First factor
+ * @b: Second factor
+ *
+ * Returns: round(a * b / 255)
+ */
+static inline u8 cf_mul8(u8 a, u8 b)
+{
+	return cf_div255((u32)a * b);
+}
+
+/**
+ * cf_scale8 - Scale a channel by a Q16 factor
+ * @c: Channel value
+ * @f: Factor, CF_Q16_ONE is 1.0
+ *
+ * Returns: round(c * f / 65536); factors above 1.0 return @c
+ */
+static inline u8 cf_scale8(u8 c, u32 f)
+{
+	u32 v;
+
+	if (f >= CF_Q16_ONE)
+		return c;
+
+	v = ((u32)c * f + (CF_Q16_ONE >> 1)) >> 16;
+	return v;
+}
+
+/**
+ * cf_pct_to_q16 - Convert a 0..100 percentage to a Q16 factor
+ * @pct: Percentage
+ *
+ * Meant for knob changes, not per-channel work: it divides once.
+ *
+ * Returns: round(pct * 65536 / 100)
+ */
+static inline u32 cf_pct_to_q16(unsigned int pct)
+{
+	if (pct >= 100)
+		return CF_Q16_ONE;
+	return (pct * CF_Q16_ONE + 50) / 100;
+}
+
+/**
+ * cf_pct_to_u8 - Convert a 0..100 percentage to 0..255
+ * @pct: Percentage
+ *
+ * Returns: round(pct * 255 / 100)
+ */
+static inline u8 cf_pct_to_u8(unsigned int pct)
+{
+	if (pct >= 100)
+		return 255;
+	/* 167117 / 65536 ~= 2.55, exact after rounding for 0..100 */
+	return (pct * 167117U + (CF_Q16_ONE >> 1)) >> 16;
+}
+
+/**
+ * cf_lerp8 - Linear interpolation between two channel values
+ * @a: Value at t = 0
+ * @b: Value at t = CF_Q16_ONE
+ * @t: Position, Q16
+ *
+ * Returns: round(a + (b - a) * t / 65536)
+ */
+static inline u8 cf_lerp8(u8 a, u8 b, u32 t)
+{
+	if (t >= CF_Q16_ONE)
+		return b;
+	return ((u32)a * (CF_Q16_ONE - t) + (u32)b * t + (CF_Q16_ONE >> 1)) >> 16;
+}
+
+/**
+ * cf_blend8 - Alpha blend @src over @dst
+ * @dst: Background channel
+ * @src: Foreground channel
+ * @alpha: Opacity of @src, 255 is opaque
+ *
+ * Returns: round((src * alpha + dst * (255 - alpha)) / 255)
+ */
+static inline u8 cf_blend8(u8 dst, u8 src, u8 alpha)
+{
+	return cf_div255((u32)src * alpha + (u32)dst * (255 - alpha));
+}
+
+/**
+ * cf_hue_from_deg - Convert a 0..359 degree hue to fixed-point hue
+ * @deg: Hue in degrees
+ *
+ * Returns: floor(deg * CF_HUE_MAX / 360)
+ */
+static inline u16 cf_hue_from_deg(unsigned int deg)
+{
+	/* 1536 / 360 = 64 / 15; 279621 / 65536 ~= 64 / 15 */
+	return (deg * 279621U) >> 16;
+}
+
+/**
+ * cf_hsv_to_rgb - Convert HSV to RGB
+ * @h: Hue, 0..CF_HUE_MAX-1 (wrapped if larger)
+ * @s: Saturation, 0..255
+ * @v: Value, 0..255
+ * @r: Output red
+ * @g: Output green
+ * @b: Output blue
+ *
+ * Within 1 of the rounded floating point result on every channel.
+ */
+static inline void cf_hsv_to_rgb(u16 h, u8 s, u8 v, u8 *r, u8 *g, u8 *b)
+{
+	unsigned int sector, f;
+	u8 p, q, t;
+
+	if (h >= CF_HUE_MAX)
+		h %= CF_HUE_MAX;
+	sector = h / CF_HUE_SECTOR;
+	f = h % CF_HUE_SECTOR;
+
+	/* v * (1 - s), v * (1 - s * f), v * (1 - s * (1 - f)) */
+	p = cf_mul8(v, 255 - s);
+	q = cf_mul8(v, 255 - ((s * f + 128) >> 8));
+	t = cf_mul8(v, 255 - ((s * (CF_HUE_SECTOR - f) + 128) >> 8));
+
+	switch (sector) {
+	case 0:
+		*r = v; *g = t; *b = p;
+		break;
+	case 1:
+		*r = q; *g = v; *b = p;
+		break;
+	case 2:
+		*r = p; *g = v; *b = t;
+		break;
+	case 3:
+		*r = p; *g = q; *b = v;
+		break;
+	case 4:
+		*r = t; *g = p; *b = v;
+		break;
+	default:
+		*r = v; *g = p; *b = q;
+		break;
+	}
+}
+
+/**
+ * cf_log2_q16 - Base-2 logarithm of a Q16 value
+ * @x: Argument, Q16, must be non-zero
+ *
+ * Bit-by-bit: squares the mantissa once per fractional result bit. For
+ * table builds on knob changes, not per-frame work.
+ *
+ * Returns: log2(x / 65536) in Q16
+ */
+static inline s32 cf_log2_q16(u32 x)
+{
+	s32 r = 0;
+	u64 z;
+	u32 bit;
+
+	while (x < CF_Q16_ONE) {
+		x <<= 1;
+		r -= CF_Q16_ONE;
+	}
+	while (x >= 2 * CF_Q16_ONE) {
+		x >>= 1;
+		r += CF_Q16_ONE;
+	}
+
+	z = x;
+	for (bit = CF_Q16_ONE >> 1; bit; bit >>= 1) {
+		z = (z * z) >> 16;
+		if (z >= 2 * CF_Q16_ONE) {
+			z >>= 1;
+			r += bit;
+		}
+	}
+	return r;
+}
+
+/**
+ * cf_exp2_q16 - Base-2 power of a non-positive Q16 exponent
+ * @y: Exponent, Q16, <= 0
+ *
+ * Returns: 2^(y / 65536) in Q16, 0..CF_Q16_ONE
+ */
+static inline u32 cf_exp2_q16(s32 y)
+{
+	/* 2^(-2^-k) for k = 1..16, Q30 */
+	static const u32 exp2_neg_q30[16] = {
+		759250125, 902905651, 984625594, 1028218693,
+		1050733751, 1062175491, 1067942999, 1070838486,
+		1072289173, 1073015252, 1073378477, 1073560135,
+		1073650976, 1073696399, 1073719111, 1073730468,
+	};
+	u32 n, frac;
+	u64 r = 1U << 30;
+	int k;
+
+	if (y >= 0)
+		return CF_Q16_ONE;
+
+	n = (u32)(-y) >> 16;
+	frac = (u32)(-y) & 0xffff;
+	if (n >= 17)
+		return 0;
+
+	for (k = 0; k < 16; k++) {
+		if (frac & (0x8000 >> k))
+			r = (r * exp2_neg_q30[k]) >> 30;
+	}
+
+	/* Q30 -> Q16 and the integer part, with rounding */
+	return (r + (1U << (13 + n))) >> (14 + n);
+}
+
+/**
+ * cf_pow_q16 - Raise a 0..1 value to a positive power
+ * @x: Base, Q16, 0..CF_Q16_ONE
+ * @g: Exponent, Q16
+ *
+ * Returns: (x / 65536)^(g / 65536) in Q16
+ */
+static inline u32 cf_pow_q16(u32 x, u32 g)
+{
+	if (!x)
+		return 0;
+	if (x >= CF_Q16_ONE)
+		return CF_Q16_ONE;
+
+	return cf_exp2_q16(((s64)cf_log2_q16(x) * g) >> 16);
+}
+
+/**
+ * cf_srgb_decode_q16 - sRGB transfer function, encoded to linear light
+ * @v: Encoded value, Q16, 0..CF_Q16_ONE
+ *
+ * Returns: linear value in Q16
+ */
+static inline u32 cf_srgb_decode_q16(u32 v)
+{
+	/* 0.04045 and 0.055 in Q16; 5072 ~ 1/12.92, 62119 ~ 1/1.055; 2.4 */
+	if (v <= 2651)
+		return (v * 5072U + (1U << 15)) >> 16;
+
+	return cf_pow_q16(((v + 3604) * 62119U + (1U << 15)) >> 16, 157286);
+}
+
+#endif /* COLOR_FIXED_H */
@@ -0,0 +1,34 @@
+# SPDX-License-Identifier: GPL-3
+#
+# Generate sin_q15_table.h: one full sine period in 2^bits steps,
+# Q15 (32767 = 1.0), plus one wrap-around entry for interpolation.
+#
+# Usage: awk -v bits=10 -f gen_sin_q15.awk > sin_q15_table.h
+
+BEGIN {
+	if (bits == "")
+		bits = 10
+	size = 2 ^ bits
+	pi = atan2(0, -1)
+
+	print "/* SPDX-License-Identifier: GPL-3 */"
+	print "/* Generated by gen_sin_q15.awk - do not edit */"
+	print ""
+	print "#ifndef SIN_Q15_TABLE_H"
+	print "#define SIN_Q15_TABLE_H"
+	print ""
+	printf "#define SIN_Q15_BITS %d\n", bits
+	print ""
+	print "static const s16 sin_q15_table[(1 << SIN_Q15_BITS) + 1] = {"
+	for (i = 0; i <= size; i++) {
+		v = sin(2 * pi * (i % size) / size) * 32767
+		v = v < 0 ? int(v - 0.5) : int(v + 0.5)
+		if (i % 8 == 0)
+			printf "\t"
+		printf "%d,", v
+		printf "%s", (i % 8 == 7 || i == size) ? "\n" : " "
+	}
+	print "};"
+	print ""
+	print "#endif /* SIN_Q15_TABLE_H */"
+}
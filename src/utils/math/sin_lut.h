@@ -1,73 +0,0 @@
-// SPDX-License-Identifier: GPL-3
-/*
- * Sine Lookup Table for Kernel Space
- *
- * Provides fast sine calculation without floating point operations
- */
-
-#ifndef SIN_LUT_H
-#define SIN_LUT_H
-
-#define SIN_LUT_SIZE 360
-
-/* Sine lookup table: values scaled by 100 for integer math
- * sin_lut[angle] = sin(angle * PI / 180) * 100
- * Range: -100 to +100
- */
-static const short sin_lut[SIN_LUT_SIZE] = {
-	0, 2, 3, 5, 7, 9, 10, 12, 14, 16,
-	17, 19, 21, 22, 24, 26, 28, 29, 31, 33,
-	34, 36, 37, 39, 41, 42, 44, 45, 47, 48,
-	50, 52, 53, 54, 56, 57, 59, 60, 62, 63,
-	64, 66, 67, 68, 69, 71, 72, 73, 74, 75,
-	77, 78, 79, 80, 81, 82, 83, 84, 85, 86,
-	87, 87, 88, 89, 90, 91, 91, 92, 93, 93,
-	94, 95, 95, 96, 96, 97, 97, 97, 98, 98,
-	98, 99, 99, 99, 99, 100, 100, 100, 100, 100,
-	100, 100, 100, 100, 100, 100, 99, 99, 99, 99,
-	98, 98, 98, 97, 97, 97, 96, 96, 95, 95,
-	94, 93, 93, 92, 91, 91, 90, 89, 88, 87,
-	87, 86, 85, 84, 83, 82, 81, 80, 79, 78,
-	77, 75, 74, 73, 72, 71, 69, 68, 67, 66,
-	64, 63, 62, 60, 59, 57, 56, 54, 53, 52,
-	50, 48, 47, 45, 44, 42, 41, 39, 37, 36,
-	34, 33, 31, 29, 28, 26, 24, 22, 21, 19,
-	17, 16, 14, 12, 10, 9, 7, 5, 3, 2,
-	0, -2, -3, -5, -7, -9, -10, -12, -14, -16,
-	-17, -19, -21, -22, -24, -26, -28, -29, -31, -33,
-	-34, -36, -37, -39, -41, -42, -44, -45, -47, -48,
-	-50, -52, -53, -54, -56, -57, -59, -60, -62, -63,
-	-64, -66, -67, -68, -69, -71, -72, -73, -74, -75,
-	-77, -78, -79, -80, -81, -82, -83, -84, -85, -86,
-	-87, -87, -88, -89, -90, -91, -91, -92, -93, -93,
-	-94, -95, -95, -96, -96, -97, -97, -97, -98, -98,
-	-98, -99, -99, -99, -99, -100, -100, -100, -100, -100,
-	-100, -100, -100, -100, -100, -100, -99, -99, -99, -99,
-	-98, -98, -98, -97, -97, -97, -96, -96, -95, -95,
-	-94, -93, -93, -92, -91, -91, -90, -89, -88, -87,
-	-87, -86, -85, -84, -83, -82, -81, -80, -79, -78,
-	-77, -75, -74, -73, -72, -71, -69, -68, -67, -66,
-	-64, -63, -62, -60, -59, -57, -56, -54, -53, -52,
-	-50, -48, -47, -45, -44, -42, -41, -39, -37, -36,
-	-34, -33, -31, -29, -28, -26, -24, -22, -21, -19,
-	-17, -16, -14, -12, -10, -9, -7, -5, -3, -2
-};
-
-/**
- * lut_sin - Fast sine calculation using lookup table
- * @angle_degrees: Angle in degrees (any value, will be normalized)
- *
- * Returns: sine value scaled by 100 (range: -100 to +100)
- *          e.g., simple_sin(90) returns 100 (representing 1.0)
- *               simple_sin(30) returns 50 (representing 0.5)
- */
-static inline int lut_sin(int angle_degrees)
-{
-	angle_degrees = angle_degrees % 360;
-	if (angle_degrees < 0)
-		angle_degrees += 360;
-
-	return sin_lut[angle_degrees];
-}
-
-#endif /* SIN_LUT_H */
@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: GPL-3
+/*
+ * Q15 Sine for Kernel Space
+ *
+ * Interpolated lookup into a power-of-two sine table generated at build
+ * time by gen_sin_q15.awk. Angles are Q16 turns: 65536 is 360 degrees,
+ * so phase accumulators wrap for free.
+ */
+
+#ifndef SIN_Q15_H
+#define SIN_Q15_H
+
+#include "sin_q15_table.h"
+
+#define SIN_Q15_SIZE		(1 << SIN_Q15_BITS)
+#define SIN_Q15_FRAC_BITS	(16 - SIN_Q15_BITS)
+
+/**
+ * sin_q15 - Sine of a Q16 turn with linear interpolation
+ * @turn: Angle, 65536 per full turn (only the low 16 bits are used)
+ *
+ * Returns: sine in Q15 (-32767 to +32767)
+ */
+static inline int sin_q15(u32 turn)
+{
+	unsigned int idx = (turn & 0xffff) >> SIN_Q15_FRAC_BITS;
+	int frac = turn & ((1 << SIN_Q15_FRAC_BITS) - 1);
+	int a = sin_q15_table[idx];
+	int b = sin_q15_table[idx + 1];
+
+	return a + (((b - a) * frac) >> SIN_Q15_FRAC_BITS);
+}
+
+#endif /* SIN_Q15_H */
@@ -10,14 +10,19 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/acpi.h>
 #include <linux/wmi.h>
 #include <linux/string.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/input.h>
 #include <linux/input/sparse-keymap.h>
 
 #include "omen_wmi.h"
+#include "omen_zones.h"
 
 #define OMEN_KEY_SCANCODE 0x21a5
 
@@ -28,6 +33,151 @@ static const struct key_entry hp_wmi_keymap[] = {
 	{ KE_END, 0 }
 };
 
+static acpi_status hp_wmi_acpi_evaluate(u32 method_id,
+					const struct acpi_buffer *in,
+					struct acpi_buffer *out)
+{
+	return wmi_evaluate_method(HPWMI_BIOS_GUID, 0, method_id, in, out);
+}
+
+static const struct hp_wmi_transport hp_wmi_acpi_transport = {
+	.name = "wmi",
+	.evaluate = hp_wmi_acpi_evaluate,
+	.ec_read = ec_read,
+	.has_events = true,
+};
+
+static const struct hp_wmi_transport *hp_wmi_transports[] = {
+	&hp_wmi_acpi_transport,
+	&hp_wmi_sim_transport,
+};
+
+static const struct hp_wmi_transport *hp_wmi_transport = &hp_wmi_acpi_transport;
+
+static char *transport = "wmi";
+module_param(transport, charp, 0444);
+MODULE_PARM_DESC(transport, "BIOS transport: wmi (default) or sim (in-memory simulator)");
+
+int hp_wmi_transport_init(void)
+{
+	const struct hp_wmi_transport *t = NULL;
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(hp_wmi_transports); i++) {
+		if (sysfs_streq(transport, hp_wmi_transports[i]->name)) {
+			t = hp_wmi_transports[i];
+			break;
+		}
+	}
+	if (!t) {
+		pr_err("unknown transport '%s'\n", transport);
+		return -EINVAL;
+	}
+
+	if (t->init) {
+		ret = t->init();
+		if (ret)
+			return ret;
+	}
+
+	hp_wmi_transport = t;
+	if (t != &hp_wmi_acpi_transport)
+		pr_info("using '%s' BIOS transport\n", t->name);
+	return 0;
+}
+
+bool hp_wmi_transport_has_bios(void)
+{
+	if (hp_wmi_transport != &hp_wmi_acpi_transport)
+		return true;
+	return wmi_has_guid(HPWMI_BIOS_GUID);
+}
+
+const char *hp_wmi_transport_name(void)
+{
+	return hp_wmi_transport->name;
+}
+
+int hp_wmi_ec_read(u8 addr, u8 *val)
+{
+	return hp_wmi_transport->ec_read(addr, val);
+}
+
+/*
+ * BIOS command arbiter. Every evaluation of the BIOS method, from any
+ * subsystem, runs one at a time. A caller is only granted the method
+ * when no caller of higher priority is waiting, so fan safety commands
+ * wait for at most the one call already in flight.
+ */
+static DEFINE_SPINLOCK(hp_wmi_arb_lock);
+static DECLARE_WAIT_QUEUE_HEAD(hp_wmi_arb_wq);
+static bool hp_wmi_arb_busy;
+static unsigned int hp_wmi_arb_waiting[HPWMI_PRIO_COUNT];
+static struct hp_wmi_arb_stats hp_wmi_arb_stats[HPWMI_PRIO_COUNT];
+
+static bool hp_wmi_arb_try_acquire(enum hp_wmi_prio prio)
+{
+	bool granted;
+	int p;
+
+	spin_lock(&hp_wmi_arb_lock);
+	granted = !hp_wmi_arb_busy;
+	for (p = prio + 1; granted && p < HPWMI_PRIO_COUNT; p++) {
+		if (hp_wmi_arb_waiting[p])
+			granted = false;
+	}
+	if (granted) {
+		hp_wmi_arb_busy = true;
+		hp_wmi_arb_waiting[prio]--;
+	}
+	spin_unlock(&hp_wmi_arb_lock);
+
+	return granted;
+}
+
+static void hp_wmi_arb_acquire(enum hp_wmi_prio prio)
+{
+	u64 start = ktime_get_ns();
+	u64 waited;
+
+	spin_lock(&hp_wmi_arb_lock);
+	hp_wmi_arb_waiting[prio]++;
+	spin_unlock(&hp_wmi_arb_lock);
+
+	wait_event(hp_wmi_arb_wq, hp_wmi_arb_try_acquire(prio));
+
+	waited = ktime_get_ns() - start;
+	spin_lock(&hp_wmi_arb_lock);
+	hp_wmi_arb_stats[prio].grants++;
+	hp_wmi_arb_stats[prio].total_wait_ns += waited;
+	if (waited > hp_wmi_arb_stats[prio].max_wait_ns)
+		hp_wmi_arb_stats[prio].max_wait_ns = waited;
+	spin_unlock(&hp_wmi_arb_lock);
+}
+
+static void hp_wmi_arb_release(void)
+{
+	spin_lock(&hp_wmi_arb_lock);
+	hp_wmi_arb_busy = false;
+	spin_unlock(&hp_wmi_arb_lock);
+
+	wake_up_all(&hp_wmi_arb_wq);
+}
+
+void hp_wmi_arb_stats_get(enum hp_wmi_prio prio, struct hp_wmi_arb_stats *out)
+{
+	spin_lock(&hp_wmi_arb_lock);
+	*out = hp_wmi_arb_stats[prio];
+	spin_unlock(&hp_wmi_arb_lock);
+}
+
+void hp_wmi_arb_stats_reset(void)
+{
+	spin_lock(&hp_wmi_arb_lock);
+	memset(hp_wmi_arb_stats, 0, sizeof(hp_wmi_arb_stats));
+	spin_unlock(&hp_wmi_arb_lock);
+}
+
 static inline int encode_outsize_for_pvsz(int outsize)
 {
 	if (outsize > 4096)
@@ -43,71 +193,232 @@ static inline int encode_outsize_for_pvsz(int outsize)
 	return 1;
 }
 
-int hp_wmi_perform_query(int query, enum hp_wmi_command command,
-			 void *buffer, int insize, int outsize)
+static int encode_outsize_bytes(int mid)
 {
-	int mid;
-	struct bios_return *bios_return;
-	int actual_outsize;
-	union acpi_object *obj;
-	struct bios_args args = {
-		.signature = 0x55434553,
-		.command = command,
-		.commandtype = query,
-		.datasize = insize,
-		.data = {0},
-	};
-	struct acpi_buffer input = {sizeof(struct bios_args), &args};
-	struct acpi_buffer output = {ACPI_ALLOCATE_BUFFER, NULL};
-	int ret = 0;
+	static const int bucket_bytes[] = { 0, 0, 4, 128, 1024, 4096 };
 
-	mid = encode_outsize_for_pvsz(outsize);
-	if (WARN_ON(mid < 0))
-		return mid;
-	if (WARN_ON(insize > sizeof(args.data)))
-		return -EINVAL;
-	memcpy(&args.data[0], buffer, insize);
+	return bucket_bytes[mid];
+}
+
+/* Decode a BIOS reply object into @buffer, returns 0 or hp_return_value */
+static int hp_wmi_parse_reply(const union acpi_object *obj, int query,
+			      void *buffer, int outsize)
+{
+	const struct bios_return *bios_return;
+	int actual_outsize;
+	int ret;
 
-	wmi_evaluate_method(HPWMI_BIOS_GUID, 0, mid, &input, &output);
-	obj = output.pointer;
 	if (!obj)
 		return -EINVAL;
-	if (obj->type != ACPI_TYPE_BUFFER) {
-		ret = -EINVAL;
-		goto out_free;
-	}
+	if (obj->type != ACPI_TYPE_BUFFER)
+		return -EINVAL;
 
 	if (obj->buffer.length < sizeof(*bios_return)) {
 		pr_warn("WMI query 0x%x returned short buffer (%lu < %zu)\n",
 			query, (unsigned long)obj->buffer.length,
 			sizeof(*bios_return));
-		ret = -EINVAL;
-		goto out_free;
+		return -EINVAL;
 	}
 
-	bios_return = (struct bios_return *)obj->buffer.pointer;
+	bios_return = (const struct bios_return *)obj->buffer.pointer;
 	ret = bios_return->return_code;
 	if (ret) {
 		if (ret != HPWMI_RET_UNKNOWN_COMMAND &&
 		    ret != HPWMI_RET_UNKNOWN_CMDTYPE)
 			pr_warn("query 0x%x returned error 0x%x\n", query, ret);
-		goto out_free;
+		return ret;
 	}
 
 	if (!outsize)
-		goto out_free;
+		return 0;
 
 	if (obj->buffer.length <= sizeof(*bios_return)) {
 		memset(buffer, 0, outsize);
-		goto out_free;
+		return 0;
 	}
 
 	actual_outsize = min(outsize, (int)(obj->buffer.length - sizeof(*bios_return)));
 	memcpy(buffer, obj->buffer.pointer + sizeof(*bios_return), actual_outsize);
 	memset(buffer + actual_outsize, 0, outsize - actual_outsize);
+	return 0;
+}
+
+int hp_wmi_perform_query_prio(enum hp_wmi_prio prio, int query,
+			      enum hp_wmi_command command,
+			      void *buffer, int insize, int outsize)
+{
+	int mid;
+	union acpi_object *obj;
+	struct bios_args args = {
+		.signature = 0x55434553,
+		.command = command,
+		.commandtype = query,
+		.datasize = insize,
+		.data = {0},
+	};
+	struct acpi_buffer input = {sizeof(struct bios_args), &args};
+	struct acpi_buffer output = {ACPI_ALLOCATE_BUFFER, NULL};
+	u64 start, elapsed;
+	int ret;
+
+	mid = encode_outsize_for_pvsz(outsize);
+	if (WARN_ON(mid < 0))
+		return mid;
+	if (WARN_ON(insize > sizeof(args.data)))
+		return -EINVAL;
+	memcpy(&args.data[0], buffer, insize);
+
+	hp_wmi_arb_acquire(prio);
+	start = ktime_get_ns();
+	hp_wmi_transport->evaluate(mid, &input, &output);
+	elapsed = ktime_get_ns() - start;
+	hp_wmi_arb_release();
+	hp_wmi_stats_count_alloc();
+
+	obj = output.pointer;
+	ret = hp_wmi_parse_reply(obj, query, buffer, outsize);
 
-out_free:
 	kfree(obj);
+	hp_wmi_stats_record(command, query, ret, elapsed);
+	return ret;
+}
+
+int hp_wmi_perform_query(int query, enum hp_wmi_command command,
+			 void *buffer, int insize, int outsize)
+{
+	return hp_wmi_perform_query_prio(HPWMI_PRIO_NORMAL, query, command,
+					 buffer, insize, outsize);
+}
+
+/*
+ * Preallocated query context for hot paths. The ACPI result is evaluated
+ * straight into @out instead of an ACPICA allocation, and @args is reused
+ * so only the bytes dirtied by the previous payload need clearing.
+ */
+struct hp_wmi_ctx {
+	struct bios_args args;
+	enum hp_wmi_prio prio;
+	int dirty;
+	acpi_size out_size;
+	void *out;
+};
+
+static acpi_size hp_wmi_ctx_out_size(int mid)
+{
+	return ACPI_ROUND_UP_TO_NATIVE_WORD(sizeof(union acpi_object)) +
+	       sizeof(struct bios_return) + encode_outsize_bytes(mid);
+}
+
+struct hp_wmi_ctx *hp_wmi_ctx_alloc(int max_outsize, enum hp_wmi_prio prio)
+{
+	int mid = encode_outsize_for_pvsz(max_outsize);
+	struct hp_wmi_ctx *ctx;
+
+	if (WARN_ON(mid < 0))
+		return NULL;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return NULL;
+
+	ctx->out_size = hp_wmi_ctx_out_size(mid);
+	ctx->out = kmalloc(ctx->out_size, GFP_KERNEL);
+	if (!ctx->out) {
+		kfree(ctx);
+		return NULL;
+	}
+
+	ctx->args.signature = 0x55434553;
+	ctx->prio = prio;
+	return ctx;
+}
+
+void hp_wmi_ctx_free(struct hp_wmi_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	kfree(ctx->out);
+	kfree(ctx);
+}
+
+/* Grow the output buffer to what the BIOS reported it needs */
+static int hp_wmi_ctx_grow(struct hp_wmi_ctx *ctx, acpi_size size)
+{
+	void *out;
+
+	if (size <= ctx->out_size)
+		return -EINVAL;
+
+	out = kmalloc(size, GFP_KERNEL);
+	if (!out)
+		return -ENOMEM;
+
+	hp_wmi_stats_count_alloc();
+	kfree(ctx->out);
+	ctx->out = out;
+	ctx->out_size = size;
+	return 0;
+}
+
+int hp_wmi_perform_query_ctx(struct hp_wmi_ctx *ctx, int query,
+			     enum hp_wmi_command command,
+			     void *buffer, int insize, int outsize)
+{
+	struct acpi_buffer input;
+	struct acpi_buffer output;
+	acpi_status status;
+	u64 start, elapsed;
+	int mid, ret;
+
+	mid = encode_outsize_for_pvsz(outsize);
+	if (!ctx || mid < 0 || hp_wmi_ctx_out_size(mid) > ctx->out_size)
+		return hp_wmi_perform_query_prio(ctx ? ctx->prio : HPWMI_PRIO_NORMAL,
+						 query, command, buffer, insize,
+						 outsize);
+
+	if (WARN_ON(insize > sizeof(ctx->args.data)))
+		return -EINVAL;
+
+	ctx->args.command = command;
+	ctx->args.commandtype = query;
+	ctx->args.datasize = insize;
+	memcpy(ctx->args.data, buffer, insize);
+	if (ctx->dirty > insize)
+		memset(ctx->args.data + insize, 0, ctx->dirty - insize);
+	ctx->dirty = insize;
+
+	input.length = sizeof(ctx->args);
+	input.pointer = &ctx->args;
+	output.length = ctx->out_size;
+	output.pointer = ctx->out;
+
+	hp_wmi_arb_acquire(ctx->prio);
+	start = ktime_get_ns();
+	status = hp_wmi_transport->evaluate(mid, &input, &output);
+	elapsed = ktime_get_ns() - start;
+
+	/*
+	 * The reply did not fit: ACPICA reports the size it needs. All
+	 * commands issued through a context are idempotent reads or
+	 * full-state writes, so grow once and evaluate again.
+	 */
+	if (status == AE_BUFFER_OVERFLOW && !hp_wmi_ctx_grow(ctx, output.length)) {
+		output.length = ctx->out_size;
+		output.pointer = ctx->out;
+
+		start = ktime_get_ns();
+		status = hp_wmi_transport->evaluate(mid, &input, &output);
+		elapsed += ktime_get_ns() - start;
+	}
+	hp_wmi_arb_release();
+
+	if (ACPI_FAILURE(status))
+		ret = -EIO;
+	else
+		ret = hp_wmi_parse_reply(ctx->out, query, buffer, outsize);
+
+	hp_wmi_stats_record(command, query, ret, elapsed);
 	return ret;
 }
 
@@ -136,6 +447,8 @@ static void hp_wmi_notify(union acpi_object *obj, void *context)
 		}
 		break;
 	default:
+		/* Firmware hotkeys may change lighting behind our back */
+		fourzone_shadow_invalidate();
 		pr_debug("Unhandled WMI event: 0x%x\n", event_id);
 		break;
 	}
@@ -146,6 +459,12 @@ int hp_wmi_input_setup(void)
 	int err;
 	acpi_status status;
 
+	if (!hp_wmi_transport->has_events) {
+		pr_info("'%s' transport has no WMI events, Omen key disabled\n",
+			hp_wmi_transport->name);
+		return 0;
+	}
+
 	hp_wmi_input_dev = input_allocate_device();
 	if (!hp_wmi_input_dev)
 		return -ENOMEM;
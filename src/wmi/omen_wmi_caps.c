@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: GPL-3
+/*
+ * HP OMEN RGB Keyboard Driver - BIOS Capability Probe
+ *
+ * Queries platform info, system design data and the read-only commands
+ * the driver used to try at setup, once at load. Subsystems consult the
+ * cached bitmap instead of issuing probing calls of their own.
+ *
+ * Author: alessandromrc
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/dmi.h>
+#include <linux/string.h>
+#include <linux/sysfs.h>
+
+#include "omen_wmi.h"
+
+#define HPWMI_CAPS_DATA_SIZE	128
+
+/* Bytes of platform info and design data shown in sysfs */
+#define HPWMI_CAPS_DATA_SHOWN	16
+
+static char *wmi_caps;
+module_param(wmi_caps, charp, 0444);
+MODULE_PARM_DESC(wmi_caps, "Skip the capability probe on this board: BOARD:BITMAP as shown in capabilities");
+
+struct hp_wmi_cap_query {
+	const char *name;
+	enum hp_wmi_command command;
+	int query;
+	int insize;
+	int outsize;
+};
+
+static const struct hp_wmi_cap_query hp_wmi_cap_queries[HPWMI_CAP_COUNT] = {
+	[HPWMI_CAP_PLATFORM_INFO] = {
+		"platform_info", HPWMI_FOURZONE, HPWMI_GET_PLATFORM_INFO,
+		0, HPWMI_CAPS_DATA_SIZE },
+	[HPWMI_CAP_SYSTEM_DESIGN_DATA] = {
+		"system_design_data", HPWMI_GAMING, HPWMI_GM_GET_SYSTEM_DESIGN_DATA,
+		0, HPWMI_CAPS_DATA_SIZE },
+	[HPWMI_CAP_FAN_SPEED] = {
+		"fan_speed", HPWMI_GAMING, HPWMI_GM_FAN_SPEED_GET, 1, 4 },
+	[HPWMI_CAP_FAN_MAX] = {
+		"fan_max", HPWMI_GAMING, HPWMI_GM_FAN_SPEED_MAX_GET, 4, 4 },
+	[HPWMI_CAP_VICTUS_FAN_SPEED] = {
+		"victus_fan_speed", HPWMI_GAMING, HPWMI_GM_VICTUS_FAN_SPEED_GET,
+		1, HPWMI_CAPS_DATA_SIZE },
+};
+
+/* Written once by hp_wmi_caps_probe() before any consumer runs */
+static unsigned long hp_wmi_caps_supported;
+static unsigned long hp_wmi_caps_unknown;	/* UNKNOWN_COMMAND/CMDTYPE */
+static bool hp_wmi_caps_cached;
+static u8 hp_wmi_platform_info[HPWMI_CAPS_DATA_SIZE];
+static u8 hp_wmi_design_data[HPWMI_CAPS_DATA_SIZE];
+
+static const char *hp_wmi_board(void)
+{
+	const char *board = dmi_get_system_info(DMI_BOARD_NAME);
+
+	return board ? board : "unknown";
+}
+
+/* Use the wmi_caps parameter if it names this board */
+static bool hp_wmi_caps_from_param(void)
+{
+	const char *sep;
+	unsigned long mask;
+
+	if (!wmi_caps)
+		return false;
+
+	sep = strrchr(wmi_caps, ':');
+	if (!sep || strncmp(wmi_caps, hp_wmi_board(), sep - wmi_caps) ||
+	    hp_wmi_board()[sep - wmi_caps] != '\0' ||
+	    kstrtoul(sep + 1, 0, &mask)) {
+		pr_info("wmi_caps does not match board %s, probing\n", hp_wmi_board());
+		return false;
+	}
+
+	hp_wmi_caps_supported = mask & (BIT(HPWMI_CAP_COUNT) - 1);
+	hp_wmi_caps_unknown = ~mask & (BIT(HPWMI_CAP_COUNT) - 1);
+	hp_wmi_caps_cached = true;
+	return true;
+}
+
+void hp_wmi_caps_probe(void)
+{
+	u8 buf[HPWMI_CAPS_DATA_SIZE];
+	int cap, ret;
+
+	if (hp_wmi_caps_from_param()) {
+		pr_info("BIOS capabilities 0x%lx from wmi_caps\n", hp_wmi_caps_supported);
+		return;
+	}
+
+	for (cap = 0; cap < HPWMI_CAP_COUNT; cap++) {
+		const struct hp_wmi_cap_query *q = &hp_wmi_cap_queries[cap];
+
+		/* Fan index 0 for the speed queries */
+		memset(buf, 0, sizeof(buf));
+		ret = hp_wmi_perform_query(q->query, q->command, buf,
+					   q->insize, q->outsize);
+		if (!ret)
+			__set_bit(cap, &hp_wmi_caps_supported);
+		else if (ret == HPWMI_RET_UNKNOWN_COMMAND ||
+			 ret == HPWMI_RET_UNKNOWN_CMDTYPE)
+			__set_bit(cap, &hp_wmi_caps_unknown);
+		else
+			pr_info("capability probe %s failed: %d\n", q->name, ret);
+
+		if (ret)
+			continue;
+		if (cap == HPWMI_CAP_PLATFORM_INFO)
+			memcpy(hp_wmi_platform_info, buf, sizeof(buf));
+		else if (cap == HPWMI_CAP_SYSTEM_DESIGN_DATA)
+			memcpy(hp_wmi_design_data, buf, sizeof(buf));
+	}
+
+	pr_info("BIOS capabilities 0x%lx on board %s\n", hp_wmi_caps_supported,
+		hp_wmi_board());
+}
+
+bool hp_wmi_has_cap(enum hp_wmi_cap cap)
+{
+	return test_bit(cap, &hp_wmi_caps_supported);
+}
+
+static ssize_t capabilities_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	int len, cap;
+
+	len = sysfs_emit(buf, "board %s\nsource %s\nbitmap 0x%lx\n",
+			 hp_wmi_board(), hp_wmi_caps_cached ? "wmi_caps" : "probe",
+			 hp_wmi_caps_supported);
+
+	for (cap = 0; cap < HPWMI_CAP_COUNT; cap++) {
+		const char *state = "error";
+
+		if (test_bit(cap, &hp_wmi_caps_supported))
+			state = "yes";
+		else if (test_bit(cap, &hp_wmi_caps_unknown))
+			state = "no";
+		len += sysfs_emit_at(buf, len, "%s %s\n",
+				     hp_wmi_cap_queries[cap].name, state);
+	}
+
+	if (!hp_wmi_caps_cached) {
+		len += sysfs_emit_at(buf, len, "platform_info_raw %*phN\n",
+				     HPWMI_CAPS_DATA_SHOWN, hp_wmi_platform_info);
+		len += sysfs_emit_at(buf, len, "system_design_data_raw %*phN\n",
+				     HPWMI_CAPS_DATA_SHOWN, hp_wmi_design_data);
+	}
+
+	/* Paste into modprobe.d to skip the probe on later loads */
+	len += sysfs_emit_at(buf, len, "wmi_caps %s:0x%lx\n", hp_wmi_board(),
+			     hp_wmi_caps_supported);
+	return len;
+}
+
+struct device_attribute hp_wmi_caps_attr = __ATTR(capabilities, 0444, capabilities_show, NULL);
@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: GPL-3
+/*
+ * HP OMEN RGB Keyboard Driver - WMI Simulator
+ *
+ * In-memory model of the HP BIOS WMI method, selected with transport=sim.
+ * Keeps the fourzone lighting buffer, fan table, fan speeds, max-fan state
+ * and EC thermal profile byte, and answers the capability probe, so the
+ * driver can be exercised and benchmarked on machines without an HP OMEN
+ * BIOS.
+ *
+ * Author: alessandromrc
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/acpi.h>
+#include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "omen_wmi.h"
+#include "omen_zones.h"
+
+#define SIM_SIGNATURE			0x55434553
+#define SIM_FAN_COUNT			2
+#define SIM_FAN_SPEED_AUTO		30	/* x100 rpm while BIOS controls fans */
+#define SIM_EC_THERMAL_PROFILE_OFFSET	0x95
+#define SIM_EC_PROFILE_DEFAULT		0x30
+
+static unsigned int sim_latency_us;
+module_param(sim_latency_us, uint, 0644);
+MODULE_PARM_DESC(sim_latency_us, "Simulator: latency added to every BIOS call in microseconds");
+
+static unsigned int sim_error_every;
+module_param(sim_error_every, uint, 0644);
+MODULE_PARM_DESC(sim_error_every, "Simulator: fail every Nth BIOS call (0 = never)");
+
+static int sim_error_code = HPWMI_RET_INVALID_PARAMETERS;
+module_param(sim_error_code, int, 0644);
+MODULE_PARM_DESC(sim_error_code, "Simulator: hp_return_value reported for injected failures");
+
+static bool sim_classic_fans;
+module_param(sim_classic_fans, bool, 0444);
+MODULE_PARM_DESC(sim_classic_fans, "Simulator: model a classic (non Victus-S) fan interface");
+
+static DEFINE_MUTEX(sim_lock);
+static u8 sim_fourzone[FOURZONE_STATE_SIZE];
+static u8 sim_fan_table[128];
+static u8 sim_fan_speed[SIM_FAN_COUNT];
+static u8 sim_fan_max_speed[SIM_FAN_COUNT];
+static int sim_max_fan;
+static u8 sim_ec_profile = SIM_EC_PROFILE_DEFAULT;
+static unsigned int sim_calls;
+
+/* Fixed replies for the capability probe; contents are placeholders */
+static const u8 sim_platform_info[] = { 0x01, 0x04, 0x00, 0x00 };
+static const u8 sim_design_data[] = { 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+static int sim_outsize_for_mid(u32 mid)
+{
+	switch (mid) {
+	case 1:
+		return 0;
+	case 2:
+		return 4;
+	case 3:
+		return 128;
+	case 4:
+		return 1024;
+	case 5:
+		return 4096;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int sim_init(void)
+{
+	static const u8 cpu_steps[] = { 20, 28, 36, 44, 52, 58 };
+	int i, zone;
+
+	mutex_lock(&sim_lock);
+
+	/* Power-on lighting: every zone OMEN red */
+	memset(sim_fourzone, 0, sizeof(sim_fourzone));
+	for (zone = 0; zone < ZONE_COUNT; zone++)
+		sim_fourzone[25 + zone * 3] = 0xff;
+
+	/* Victus-S fan table: { unknown, num_entries } then { cpu, gpu, ? } */
+	memset(sim_fan_table, 0, sizeof(sim_fan_table));
+	sim_fan_table[1] = ARRAY_SIZE(cpu_steps);
+	for (i = 0; i < ARRAY_SIZE(cpu_steps); i++) {
+		sim_fan_table[2 + i * 3 + 0] = cpu_steps[i];
+		sim_fan_table[2 + i * 3 + 1] = cpu_steps[i] + 2;
+	}
+	sim_fan_max_speed[0] = cpu_steps[ARRAY_SIZE(cpu_steps) - 1];
+	sim_fan_max_speed[1] = sim_fan_max_speed[0] + 2;
+
+	sim_fan_speed[0] = SIM_FAN_SPEED_AUTO;
+	sim_fan_speed[1] = SIM_FAN_SPEED_AUTO;
+	sim_max_fan = 0;
+	sim_ec_profile = SIM_EC_PROFILE_DEFAULT;
+	sim_calls = 0;
+
+	mutex_unlock(&sim_lock);
+
+	pr_info("WMI simulator ready (%s fans, latency %u us)\n",
+		sim_classic_fans ? "classic" : "Victus-S", sim_latency_us);
+	return 0;
+}
+
+/* Caller holds sim_lock. Returns an hp_return_value, 0 on success. */
+static int sim_gaming(const struct bios_args *args, u8 *out, int outsize)
+{
+	int fan;
+
+	switch (args->commandtype) {
+	case HPWMI_GM_FAN_COUNT:
+		if (outsize >= 1)
+			out[0] = SIM_FAN_COUNT;
+		return 0;
+	case HPWMI_GM_FAN_SPEED_GET:
+		fan = args->data[0];
+		if (fan >= SIM_FAN_COUNT)
+			return HPWMI_RET_INVALID_PARAMETERS;
+		if (outsize >= 4) {
+			unsigned int rpm = sim_fan_speed[fan] * 100;
+
+			out[2] = rpm >> 8;
+			out[3] = rpm & 0xff;
+		}
+		return 0;
+	case HPWMI_GM_SET_PERFORMANCE_MODE:
+		sim_ec_profile = args->data[1];
+		return 0;
+	case HPWMI_GM_FAN_SPEED_MAX_GET:
+		if (outsize >= 1)
+			out[0] = sim_max_fan;
+		return 0;
+	case HPWMI_GM_FAN_SPEED_MAX_SET:
+		sim_max_fan = args->data[0] ? 1 : 0;
+		for (fan = 0; fan < SIM_FAN_COUNT; fan++)
+			sim_fan_speed[fan] = sim_max_fan ? sim_fan_max_speed[fan] :
+					     SIM_FAN_SPEED_AUTO;
+		return 0;
+	case HPWMI_GM_VICTUS_FAN_SPEED_GET:
+		if (sim_classic_fans)
+			return HPWMI_RET_UNKNOWN_CMDTYPE;
+		memcpy(out, sim_fan_speed, min_t(int, outsize, SIM_FAN_COUNT));
+		return 0;
+	case HPWMI_GM_VICTUS_FAN_SPEED_SET:
+		if (sim_classic_fans)
+			return HPWMI_RET_UNKNOWN_CMDTYPE;
+		for (fan = 0; fan < SIM_FAN_COUNT; fan++)
+			sim_fan_speed[fan] = args->data[fan] ? args->data[fan] :
+					     SIM_FAN_SPEED_AUTO;
+		return 0;
+	case HPWMI_GM_VICTUS_FAN_TABLE_GET:
+		if (sim_classic_fans)
+			return HPWMI_RET_UNKNOWN_CMDTYPE;
+		memcpy(out, sim_fan_table, min_t(int, outsize, sizeof(sim_fan_table)));
+		return 0;
+	case HPWMI_GM_GET_SYSTEM_DESIGN_DATA:
+		memcpy(out, sim_design_data, min_t(int, outsize, sizeof(sim_design_data)));
+		return 0;
+	default:
+		return HPWMI_RET_UNKNOWN_CMDTYPE;
+	}
+}
+
+/* Caller holds sim_lock. Returns an hp_return_value, 0 on success. */
+static int sim_fourzone_query(const struct bios_args *args, u8 *out, int outsize)
+{
+	switch (args->commandtype) {
+	case HPWMI_GET_PLATFORM_INFO:
+		memcpy(out, sim_platform_info,
+		       min_t(int, outsize, sizeof(sim_platform_info)));
+		return 0;
+	case HPWMI_FOURZONE_COLOR_GET:
+		break;
+	case HPWMI_FOURZONE_COLOR_SET:
+		memcpy(sim_fourzone, args->data,
+		       min_t(u32, args->datasize, sizeof(sim_fourzone)));
+		break;
+	default:
+		return HPWMI_RET_UNKNOWN_CMDTYPE;
+	}
+
+	memcpy(out, sim_fourzone, min_t(int, outsize, sizeof(sim_fourzone)));
+	return 0;
+}
+
+static acpi_status sim_evaluate(u32 method_id, const struct acpi_buffer *in,
+				struct acpi_buffer *out)
+{
+	const struct bios_args *args = in->pointer;
+	struct bios_return *ret;
+	union acpi_object *obj;
+	size_t hdr, total;
+	int outsize;
+	bool inject;
+	u8 *data;
+
+	outsize = sim_outsize_for_mid(method_id);
+	if (outsize < 0 || !args || in->length < sizeof(*args))
+		return AE_BAD_PARAMETER;
+
+	hdr = ACPI_ROUND_UP_TO_NATIVE_WORD(sizeof(union acpi_object));
+	total = hdr + sizeof(*ret) + outsize;
+
+	if (out->length == ACPI_ALLOCATE_BUFFER) {
+		obj = kzalloc(total, GFP_KERNEL);
+		if (!obj)
+			return AE_NO_MEMORY;
+		out->pointer = obj;
+	} else if (out->length < total) {
+		out->length = total;
+		return AE_BUFFER_OVERFLOW;
+	} else {
+		obj = out->pointer;
+		memset(obj, 0, total);
+	}
+	out->length = total;
+
+	obj->buffer.type = ACPI_TYPE_BUFFER;
+	obj->buffer.length = sizeof(*ret) + outsize;
+	obj->buffer.pointer = (u8 *)obj + hdr;
+	ret = (struct bios_return *)obj->buffer.pointer;
+	data = obj->buffer.pointer + sizeof(*ret);
+
+	/* Model BIOS time spent in ACPI without holding the state lock */
+	if (sim_latency_us)
+		fsleep(sim_latency_us);
+
+	mutex_lock(&sim_lock);
+	sim_calls++;
+	inject = sim_error_every && !(sim_calls % sim_error_every);
+
+	if (args->signature != SIM_SIGNATURE)
+		ret->return_code = HPWMI_RET_WRONG_SIGNATURE;
+	else if (inject)
+		ret->return_code = sim_error_code;
+	else if (args->command == HPWMI_FOURZONE)
+		ret->return_code = sim_fourzone_query(args, data, outsize);
+	else if (args->command == HPWMI_GAMING)
+		ret->return_code = sim_gaming(args, data, outsize);
+	else
+		ret->return_code = HPWMI_RET_UNKNOWN_COMMAND;
+	mutex_unlock(&sim_lock);
+
+	return AE_OK;
+}
+
+static int sim_ec_read(u8 addr, u8 *val)
+{
+	if (addr != SIM_EC_THERMAL_PROFILE_OFFSET)
+		return -EIO;
+
+	mutex_lock(&sim_lock);
+	*val = sim_ec_profile;
+	mutex_unlock(&sim_lock);
+	return 0;
+}
+
+const struct hp_wmi_transport hp_wmi_sim_transport = {
+	.name = "sim",
+	.init = sim_init,
+	.evaluate = sim_evaluate,
+	.ec_read = sim_ec_read,
+	.has_events = false,
+};
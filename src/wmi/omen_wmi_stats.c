@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: GPL-3
+/*
+ * HP OMEN RGB Keyboard Driver - WMI Statistics
+ *
+ * Per-command BIOS call counters and latency histograms, exposed in
+ * debugfs as omen-rgb-keyboard/wmi_stats
+ *
+ * Author: alessandromrc
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+
+#include "omen_rgb_keyboard.h"
+#include "omen_wmi.h"
+
+/* Bucket n counts calls taking [2^(n-1), 2^n) us; bucket 0 is below 1 us */
+#define HPWMI_STAT_BUCKETS	21
+
+enum hp_wmi_stat_err {
+	HPWMI_STAT_ERR_TRANSPORT,
+	HPWMI_STAT_ERR_WRONG_SIGNATURE,
+	HPWMI_STAT_ERR_UNKNOWN_COMMAND,
+	HPWMI_STAT_ERR_UNKNOWN_CMDTYPE,
+	HPWMI_STAT_ERR_INVALID_PARAMETERS,
+	HPWMI_STAT_ERR_OTHER,
+	HPWMI_STAT_ERR_COUNT
+};
+
+static const char * const hp_wmi_stat_err_names[HPWMI_STAT_ERR_COUNT] = {
+	"transport", "wrong_signature", "unknown_command",
+	"unknown_cmdtype", "invalid_parameters", "other"
+};
+
+static const char * const hp_wmi_prio_names[HPWMI_PRIO_COUNT] = {
+	"lighting", "normal", "fan"
+};
+
+struct hp_wmi_stat_key {
+	u32 command;
+	u32 query;
+	const char *name;
+};
+
+/* Commands the driver issues; anything else is accounted as "other" */
+static const struct hp_wmi_stat_key hp_wmi_stat_keys[] = {
+	{ HPWMI_FOURZONE, HPWMI_GET_PLATFORM_INFO, "platform_info" },
+	{ HPWMI_FOURZONE, HPWMI_FOURZONE_COLOR_GET, "fourzone_color_get" },
+	{ HPWMI_FOURZONE, HPWMI_FOURZONE_COLOR_SET, "fourzone_color_set" },
+	{ HPWMI_GAMING, HPWMI_GM_FAN_COUNT, "fan_count" },
+	{ HPWMI_GAMING, HPWMI_GM_FAN_SPEED_GET, "fan_speed_get" },
+	{ HPWMI_GAMING, HPWMI_GM_SET_PERFORMANCE_MODE, "set_performance_mode" },
+	{ HPWMI_GAMING, HPWMI_GM_FAN_SPEED_MAX_GET, "fan_speed_max_get" },
+	{ HPWMI_GAMING, HPWMI_GM_FAN_SPEED_MAX_SET, "fan_speed_max_set" },
+	{ HPWMI_GAMING, HPWMI_GM_GET_SYSTEM_DESIGN_DATA, "system_design_data" },
+	{ HPWMI_GAMING, HPWMI_GM_VICTUS_FAN_SPEED_GET, "victus_fan_speed_get" },
+	{ HPWMI_GAMING, HPWMI_GM_VICTUS_FAN_SPEED_SET, "victus_fan_speed_set" },
+	{ HPWMI_GAMING, HPWMI_GM_VICTUS_FAN_TABLE_GET, "victus_fan_table_get" },
+};
+
+#define HPWMI_STAT_SLOTS	(ARRAY_SIZE(hp_wmi_stat_keys) + 1)
+
+struct hp_wmi_cmd_stats {
+	u64 calls;
+	u64 errors[HPWMI_STAT_ERR_COUNT];
+	u64 total_ns;
+	u64 min_ns;
+	u64 max_ns;
+	u64 hist[HPWMI_STAT_BUCKETS];
+};
+
+struct hp_wmi_stats {
+	struct hp_wmi_cmd_stats cmd[HPWMI_STAT_SLOTS];
+};
+
+static struct hp_wmi_stats __percpu *hp_wmi_stats;
+static atomic64_t hp_wmi_acpi_allocs = ATOMIC64_INIT(0);
+static struct dentry *hp_wmi_debugfs_dir;
+
+static unsigned int hp_wmi_stat_slot(u32 command, u32 query)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(hp_wmi_stat_keys); i++) {
+		if (hp_wmi_stat_keys[i].command == command &&
+		    hp_wmi_stat_keys[i].query == query)
+			return i;
+	}
+	return ARRAY_SIZE(hp_wmi_stat_keys);
+}
+
+static enum hp_wmi_stat_err hp_wmi_stat_err_class(int ret)
+{
+	if (ret < 0)
+		return HPWMI_STAT_ERR_TRANSPORT;
+
+	switch (ret) {
+	case HPWMI_RET_WRONG_SIGNATURE:
+		return HPWMI_STAT_ERR_WRONG_SIGNATURE;
+	case HPWMI_RET_UNKNOWN_COMMAND:
+		return HPWMI_STAT_ERR_UNKNOWN_COMMAND;
+	case HPWMI_RET_UNKNOWN_CMDTYPE:
+		return HPWMI_STAT_ERR_UNKNOWN_CMDTYPE;
+	case HPWMI_RET_INVALID_PARAMETERS:
+		return HPWMI_STAT_ERR_INVALID_PARAMETERS;
+	default:
+		return HPWMI_STAT_ERR_OTHER;
+	}
+}
+
+void hp_wmi_stats_count_alloc(void)
+{
+	atomic64_inc(&hp_wmi_acpi_allocs);
+}
+
+void hp_wmi_stats_record(u32 command, u32 query, int ret, u64 ns)
+{
+	struct hp_wmi_cmd_stats *st;
+	unsigned int bucket;
+
+	if (!hp_wmi_stats)
+		return;
+
+	/* ns >> 10 approximates microseconds without a divide */
+	bucket = min_t(unsigned int, fls64(ns >> 10), HPWMI_STAT_BUCKETS - 1);
+
+	st = &get_cpu_ptr(hp_wmi_stats)->cmd[hp_wmi_stat_slot(command, query)];
+	st->calls++;
+	if (ret)
+		st->errors[hp_wmi_stat_err_class(ret)]++;
+	st->total_ns += ns;
+	if (!st->min_ns || ns < st->min_ns)
+		st->min_ns = ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+	st->hist[bucket]++;
+	put_cpu_ptr(hp_wmi_stats);
+}
+
+static void hp_wmi_stats_sum(unsigned int slot, struct hp_wmi_cmd_stats *sum)
+{
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		const struct hp_wmi_cmd_stats *st =
+			&per_cpu_ptr(hp_wmi_stats, cpu)->cmd[slot];
+
+		if (!st->calls)
+			continue;
+		sum->calls += st->calls;
+		for (i = 0; i < HPWMI_STAT_ERR_COUNT; i++)
+			sum->errors[i] += st->errors[i];
+		sum->total_ns += st->total_ns;
+		if (!sum->min_ns || st->min_ns < sum->min_ns)
+			sum->min_ns = st->min_ns;
+		if (st->max_ns > sum->max_ns)
+			sum->max_ns = st->max_ns;
+		for (i = 0; i < HPWMI_STAT_BUCKETS; i++)
+			sum->hist[i] += st->hist[i];
+	}
+}
+
+static int wmi_stats_show(struct seq_file *m, void *unused)
+{
+	struct hp_wmi_arb_stats arb;
+	struct hp_wmi_cmd_stats sum;
+	unsigned int slot;
+	int i;
+
+	seq_printf(m, "transport: %s\n", hp_wmi_transport_name());
+	seq_printf(m, "acpi_allocations: %lld\n", atomic64_read(&hp_wmi_acpi_allocs));
+
+	seq_puts(m, "\narbiter\n");
+	for (i = 0; i < HPWMI_PRIO_COUNT; i++) {
+		hp_wmi_arb_stats_get(i, &arb);
+		seq_printf(m, "  %s: grants %llu wait_us avg %llu max %llu\n",
+			   hp_wmi_prio_names[i], arb.grants,
+			   arb.grants ? div64_u64(arb.total_wait_ns, arb.grants) /
+					NSEC_PER_USEC : 0,
+			   arb.max_wait_ns / NSEC_PER_USEC);
+	}
+
+	for (slot = 0; slot < HPWMI_STAT_SLOTS; slot++) {
+		hp_wmi_stats_sum(slot, &sum);
+		if (!sum.calls)
+			continue;
+
+		if (slot < ARRAY_SIZE(hp_wmi_stat_keys))
+			seq_printf(m, "\n%s (0x%06x/0x%02x)\n",
+				   hp_wmi_stat_keys[slot].name,
+				   hp_wmi_stat_keys[slot].command,
+				   hp_wmi_stat_keys[slot].query);
+		else
+			seq_puts(m, "\nother\n");
+
+		seq_printf(m, "  calls: %llu\n", sum.calls);
+		seq_printf(m, "  latency_us: min %llu avg %llu max %llu\n",
+			   sum.min_ns / NSEC_PER_USEC,
+			   div64_u64(sum.total_ns, sum.calls) / NSEC_PER_USEC,
+			   sum.max_ns / NSEC_PER_USEC);
+
+		seq_puts(m, "  errors:");
+		for (i = 0; i < HPWMI_STAT_ERR_COUNT; i++)
+			seq_printf(m, " %s=%llu", hp_wmi_stat_err_names[i],
+				   sum.errors[i]);
+		seq_putc(m, '\n');
+
+		seq_puts(m, "  histogram_us:");
+		for (i = 0; i < HPWMI_STAT_BUCKETS; i++) {
+			if (!sum.hist[i])
+				continue;
+			if (i == 0)
+				seq_printf(m, " <1:%llu", sum.hist[i]);
+			else
+				seq_printf(m, " %lu-%lu:%llu", 1UL << (i - 1),
+					   (1UL << i) - 1, sum.hist[i]);
+		}
+		seq_putc(m, '\n');
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wmi_stats);
+
+static ssize_t wmi_stats_reset_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(hp_wmi_stats, cpu), 0, sizeof(struct hp_wmi_stats));
+	atomic64_set(&hp_wmi_acpi_allocs, 0);
+	hp_wmi_arb_stats_reset();
+
+	return count;
+}
+
+static const struct file_operations wmi_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.write = wmi_stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+int hp_wmi_debugfs_init(void)
+{
+	hp_wmi_stats = alloc_percpu(struct hp_wmi_stats);
+	if (!hp_wmi_stats)
+		return -ENOMEM;
+
+	hp_wmi_debugfs_dir = debugfs_create_dir(DRIVER_NAME, NULL);
+	debugfs_create_file("wmi_stats", 0444, hp_wmi_debugfs_dir, NULL,
+			    &wmi_stats_fops);
+	debugfs_create_file("wmi_stats_reset", 0200, hp_wmi_debugfs_dir, NULL,
+			    &wmi_stats_reset_fops);
+	return 0;
+}
+
+struct dentry *hp_wmi_debugfs_root(void)
+{
+	return hp_wmi_debugfs_dir;
+}
+
+void hp_wmi_debugfs_cleanup(void)
+{
+	struct hp_wmi_stats __percpu *stats = hp_wmi_stats;
+
+	debugfs_remove_recursive(hp_wmi_debugfs_dir);
+	hp_wmi_debugfs_dir = NULL;
+
+	hp_wmi_stats = NULL;
+	free_percpu(stats);
+}
@@ -11,8 +11,11 @@
 
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/ctype.h>
 #include <linux/device.h>
 #include <linux/leds.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/string.h>
 
 #include "omen_rgb_keyboard.h"
@@ -21,6 +24,7 @@
 #include "omen_animations.h"
 #include "omen_state.h"
 #include "omen_hda_led.h"
+#include "../utils/math/color_fixed.h"
 
 struct device_attribute *zone_dev_attrs;
 struct attribute **zone_attrs;
@@ -28,11 +32,13 @@ struct platform_zone *zone_data;
 
 static struct platform_device *zone_platform_dev;
 
-struct platform_zone original_colors[ZONE_COUNT];
-int global_brightness = 100;
-
 struct led_classdev omen_kbd_led;
 
+static const struct bin_attribute *const zone_bin_attrs[] = {
+	&omen_state_bin_attr,
+	NULL
+};
+
 static struct attribute_group zone_attribute_group = {
 	.name = "rgb_zones",
 };
@@ -69,76 +75,264 @@ struct platform_zone *match_zone(struct device_attribute *attr)
 	return NULL;
 }
 
-int fourzone_update_led(struct platform_zone *zone, enum hp_wmi_command rw)
+/*
+ * In-kernel copy of the BIOS fourzone state buffer. Loaded on first use
+ * (fourzone_setup), patched on every successful SET and only re-read after
+ * fourzone_shadow_invalidate(), so zone writes need a single WMI call.
+ */
+static u8 fourzone_shadow[FOURZONE_STATE_SIZE];
+static bool fourzone_shadow_valid;
+static DEFINE_MUTEX(fourzone_lock);
+
+/* Preallocated WMI context for the lighting path, used under fourzone_lock */
+static struct hp_wmi_ctx *fourzone_ctx;
+
+/* Frame commit accounting, protected by fourzone_lock */
+static u64 frames_committed;
+static u64 frames_skipped;
+static u64 frames_coalesced;
+
+/*
+ * Newest frame waiting for fourzone_lock. Whoever gets the lock commits
+ * the latest published frame; callers whose frame was overtaken by a
+ * newer one return without another BIOS call.
+ */
+static DEFINE_SPINLOCK(fourzone_pending_lock);
+static struct color_platform fourzone_pending[ZONE_COUNT];
+static u64 fourzone_pending_seq;
+static u64 fourzone_done_seq;	/* protected by fourzone_lock */
+
+/* Last frame the hardware shows, before brightness; under fourzone_lock */
+static struct color_platform fourzone_shown[ZONE_COUNT];
+
+/* Caller must hold fourzone_lock */
+static int fourzone_shadow_load(void)
 {
-	u8 state[128];
-	int ret = hp_wmi_perform_query(HPWMI_FOURZONE_COLOR_GET, HPWMI_FOURZONE,
-				       &state, sizeof(state), sizeof(state));
+	int ret = hp_wmi_perform_query_ctx(fourzone_ctx, HPWMI_FOURZONE_COLOR_GET,
+					   HPWMI_FOURZONE, fourzone_shadow,
+					   sizeof(fourzone_shadow),
+					   sizeof(fourzone_shadow));
 	if (ret) {
 		pr_warn("fourzone_color_get returned error 0x%x\n", ret);
 		return ret <= 0 ? ret : -EINVAL;
 	}
 
-	if (rw == HPWMI_WRITE) {
-		state[zone->offset + 0] = zone->colors.red;
-		state[zone->offset + 1] = zone->colors.green;
-		state[zone->offset + 2] = zone->colors.blue;
+	fourzone_shadow_valid = true;
+	return 0;
+}
 
-		ret = hp_wmi_perform_query(HPWMI_FOURZONE_COLOR_SET, HPWMI_FOURZONE,
-					   &state, sizeof(state), sizeof(state));
-		if (ret)
-			pr_warn("fourzone_color_set returned error 0x%x\n", ret);
-		return ret;
-	} else {
-		zone->colors.red = state[zone->offset + 0];
-		zone->colors.green = state[zone->offset + 1];
-		zone->colors.blue = state[zone->offset + 2];
+/*
+ * Output stage: brightness and gamma folded into one table, rebuilt only
+ * when either changes and applied to every channel sent to the BIOS.
+ * Protected by fourzone_lock.
+ */
+enum fourzone_gamma_mode {
+	FOURZONE_GAMMA_LINEAR,
+	FOURZONE_GAMMA_SRGB,
+	FOURZONE_GAMMA_POWER,
+};
+
+static u8 fourzone_out_lut[256];
+static enum fourzone_gamma_mode fourzone_gamma_mode = FOURZONE_GAMMA_LINEAR;
+static u32 fourzone_gamma_q16 = CF_Q16_ONE;	/* exponent for FOURZONE_GAMMA_POWER */
+
+/* Caller must hold fourzone_lock */
+static void fourzone_out_lut_build(int brightness)
+{
+	u32 b = cf_pct_to_q16(brightness);
+	u32 v;
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		/* Brightness scales the encoded value, gamma decodes it */
+		v = (i * b + 127) / 255;
+
+		switch (fourzone_gamma_mode) {
+		case FOURZONE_GAMMA_SRGB:
+			v = cf_srgb_decode_q16(v);
+			break;
+		case FOURZONE_GAMMA_POWER:
+			v = cf_pow_q16(v, fourzone_gamma_q16);
+			break;
+		default:
+			break;
+		}
+
+		fourzone_out_lut[i] = min_t(u32, (v * 255 + (CF_Q16_ONE >> 1)) >> 16, 255);
 	}
-	return 0;
 }
 
-void apply_brightness_to_color(struct color_platform *color)
+/* Caller must hold fourzone_lock */
+static void fourzone_patch_color(u8 *state, u8 offset,
+				 const struct color_platform *color)
 {
-	color->red = (color->red * global_brightness) / 100;
-	color->green = (color->green * global_brightness) / 100;
-	color->blue = (color->blue * global_brightness) / 100;
+	state[offset + 0] = fourzone_out_lut[color->red];
+	state[offset + 1] = fourzone_out_lut[color->green];
+	state[offset + 2] = fourzone_out_lut[color->blue];
+}
+
+void fourzone_shadow_invalidate(void)
+{
+	WRITE_ONCE(fourzone_shadow_valid, false);
+}
+
+int fourzone_shadow_resync(void)
+{
+	int ret;
+
+	mutex_lock(&fourzone_lock);
+	fourzone_shadow_valid = false;
+	ret = fourzone_shadow_load();
+	mutex_unlock(&fourzone_lock);
+	return ret;
 }
 
-void update_all_zones_with_colors(struct color_platform colors[ZONE_COUNT])
+int fourzone_read_zone(struct platform_zone *zone)
 {
-	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		zone_data[zone].colors = colors[zone];
-		apply_brightness_to_color(&zone_data[zone].colors);
-		fourzone_update_led(&zone_data[zone], HPWMI_WRITE);
+	int ret = 0;
+
+	mutex_lock(&fourzone_lock);
+	if (!READ_ONCE(fourzone_shadow_valid))
+		ret = fourzone_shadow_load();
+	if (!ret) {
+		zone->colors.red = fourzone_shadow[zone->offset + 0];
+		zone->colors.green = fourzone_shadow[zone->offset + 1];
+		zone->colors.blue = fourzone_shadow[zone->offset + 2];
 	}
+	mutex_unlock(&fourzone_lock);
+	return ret;
+}
+
+int fourzone_commit_frame(const struct color_platform colors[ZONE_COUNT])
+{
+	struct color_platform frame[ZONE_COUNT];
+	u8 state[FOURZONE_STATE_SIZE];
+	u64 seq, my_seq;
+	int ret = 0;
+	int zone;
+
+	spin_lock(&fourzone_pending_lock);
+	memcpy(fourzone_pending, colors, sizeof(fourzone_pending));
+	my_seq = ++fourzone_pending_seq;
+	spin_unlock(&fourzone_pending_lock);
+
+	mutex_lock(&fourzone_lock);
+	if (fourzone_done_seq >= my_seq) {
+		/* A newer frame was committed while we waited for the lock */
+		frames_coalesced++;
+		goto out_unlock;
+	}
+
+	spin_lock(&fourzone_pending_lock);
+	memcpy(frame, fourzone_pending, sizeof(frame));
+	seq = fourzone_pending_seq;
+	spin_unlock(&fourzone_pending_lock);
+
+	if (!READ_ONCE(fourzone_shadow_valid)) {
+		ret = fourzone_shadow_load();
+		if (ret)
+			goto out_unlock;
+	}
+
+	memcpy(state, fourzone_shadow, sizeof(state));
+	for (zone = 0; zone < ZONE_COUNT; zone++) {
+		zone_data[zone].colors = frame[zone];
+		fourzone_patch_color(state, zone_data[zone].offset, &frame[zone]);
+	}
+
+	/* Hardware already shows this frame, nothing to send */
+	if (!memcmp(state, fourzone_shadow, sizeof(state))) {
+		frames_skipped++;
+		fourzone_done_seq = seq;
+		memcpy(fourzone_shown, frame, sizeof(fourzone_shown));
+		goto out_unlock;
+	}
+
+	ret = hp_wmi_perform_query_ctx(fourzone_ctx, HPWMI_FOURZONE_COLOR_SET,
+				       HPWMI_FOURZONE, &state, sizeof(state),
+				       sizeof(state));
+	if (ret) {
+		pr_warn("fourzone_color_set returned error 0x%x\n", ret);
+		goto out_unlock;
+	}
+
+	for (zone = 0; zone < ZONE_COUNT; zone++)
+		fourzone_patch_color(fourzone_shadow, zone_data[zone].offset,
+				     &frame[zone]);
+	frames_committed++;
+	fourzone_done_seq = seq;
+	memcpy(fourzone_shown, frame, sizeof(fourzone_shown));
+
+out_unlock:
+	mutex_unlock(&fourzone_lock);
+	return ret;
+}
+
+void fourzone_shown_frame(struct color_platform colors[ZONE_COUNT])
+{
+	mutex_lock(&fourzone_lock);
+	memcpy(colors, fourzone_shown, sizeof(fourzone_shown));
+	mutex_unlock(&fourzone_lock);
+}
+
+int update_all_zones_with_colors(struct color_platform colors[ZONE_COUNT])
+{
+	return fourzone_commit_frame(colors);
+}
+
+int update_all_zones_with_original_colors(void)
+{
+	struct color_platform colors[ZONE_COUNT];
+	struct render_state rs;
+
+	/* The stream owns the output; its release shows this state */
+	if (animation_held())
+		return 0;
+
+	/* Static layers stay on top of the zone colors */
+	render_state_read(&rs);
+	animation_compose_static(&rs, colors);
+	return update_all_zones_with_colors(colors);
 }
 
 static int omen_apply_brightness(unsigned long level)
 {
-	int ret;
+	struct render_state *rs;
+	int ret = 0;
 
 	if (level > 100)
 		level = 100;
 
-	global_brightness = level;
+	render_state_lock();
+	rs = render_state_write_begin();
+	rs->brightness = level;
+	render_state_write_end();
 
-	for (int zone = 0; zone < ZONE_COUNT; zone++) {
-		zone_data[zone].colors.red = (original_colors[zone].colors.red * level) / 100;
-		zone_data[zone].colors.green = (original_colors[zone].colors.green * level) / 100;
-		zone_data[zone].colors.blue = (original_colors[zone].colors.blue * level) / 100;
+	mutex_lock(&fourzone_lock);
+	fourzone_out_lut_build(level);
+	mutex_unlock(&fourzone_lock);
 
-		ret = fourzone_update_led(&zone_data[zone], HPWMI_WRITE);
-		if (ret)
-			return ret;
-	}
+	/* A running animation shows it with its next frame */
+	if (!animation_running())
+		ret = update_all_zones_with_original_colors();
+	if (!ret)
+		save_animation_state();
+	render_state_unlock();
 
-	save_animation_state();
-	return 0;
+	return ret;
+}
+
+static int omen_get_brightness(void)
+{
+	struct render_state rs;
+
+	render_state_read(&rs);
+	return rs.brightness;
 }
 
 enum led_brightness omen_kbd_brightness_get(struct led_classdev *led_cdev)
 {
-	return global_brightness;
+	return omen_get_brightness();
 }
 
 int omen_kbd_brightness_set(struct led_classdev *led_cdev,
@@ -154,7 +348,7 @@ ssize_t zone_show(struct device *dev, struct device_attribute *attr,
 	int ret;
 	if (target_zone == NULL)
 		return sprintf(buf, "red: -1, green: -1, blue: -1\n");
-	ret = fourzone_update_led(target_zone, HPWMI_READ);
+	ret = fourzone_read_zone(target_zone);
 	if (ret)
 		return sprintf(buf, "red: -1, green: -1, blue: -1\n");
 	return sprintf(buf, "#%02x%02x%02x\n",
@@ -166,41 +360,41 @@ ssize_t zone_set(struct device *dev, struct device_attribute *attr,
 		 const char *buf, size_t count)
 {
 	struct platform_zone *target_zone = match_zone(attr);
+	struct platform_zone temp;
+	struct render_state *rs;
 	int ret;
 	if (target_zone == NULL) {
 		pr_err("invalid target zone\n");
 		return -EINVAL;
 	}
-	ret = parse_rgb(buf, target_zone);
+	ret = parse_rgb(buf, &temp);
 	if (ret)
 		return ret;
 
-	int zone_idx = target_zone - zone_data;
-	original_colors[zone_idx].colors.red = target_zone->colors.red;
-	original_colors[zone_idx].colors.green = target_zone->colors.green;
-	original_colors[zone_idx].colors.blue = target_zone->colors.blue;
-
-	animation_stop();
+	render_state_lock();
+	animation_halt();
 	animation_set_mode(ANIMATION_STATIC);
 
-	target_zone->colors.red = (target_zone->colors.red * global_brightness) / 100;
-	target_zone->colors.green = (target_zone->colors.green * global_brightness) / 100;
-	target_zone->colors.blue = (target_zone->colors.blue * global_brightness) / 100;
+	rs = render_state_write_begin();
+	rs->colors[target_zone - zone_data] = temp.colors;
+	render_state_write_end();
 
-	ret = fourzone_update_led(target_zone, HPWMI_WRITE);
-	if (ret)
-		return ret;
-	
-	/* Save state */
-	save_animation_state();
-	
-	return count;
+	ret = update_all_zones_with_original_colors();
+	/* Animated layers keep running over the new static colors */
+	animation_start();
+	if (!ret) {
+		/* Save state */
+		save_animation_state();
+	}
+	render_state_unlock();
+
+	return ret ? ret : count;
 }
 
 ssize_t brightness_show(struct device *dev, struct device_attribute *attr,
 			char *buf)
 {
-	return sprintf(buf, "%d\n", global_brightness);
+	return sprintf(buf, "%d\n", omen_get_brightness());
 }
 
 ssize_t brightness_set(struct device *dev, struct device_attribute *attr,
@@ -223,7 +417,7 @@ ssize_t all_show(struct device *dev, struct device_attribute *attr,
 		 char *buf)
 {
 	int ret;
-	ret = fourzone_update_led(&zone_data[0], HPWMI_READ);
+	ret = fourzone_read_zone(&zone_data[0]);
 	if (ret)
 		return sprintf(buf, "red: -1, green: -1, blue: -1\n");
 	return sprintf(buf, "#%02x%02x%02x\n",
@@ -235,6 +429,7 @@ ssize_t all_set(struct device *dev, struct device_attribute *attr,
 		const char *buf, size_t count)
 {
 	struct platform_zone temp;
+	struct render_state *rs;
 	int ret;
 	u8 z;
 
@@ -242,26 +437,26 @@ ssize_t all_set(struct device *dev, struct device_attribute *attr,
 	if (ret)
 		return ret;
 
-	animation_stop();
+	render_state_lock();
+	animation_halt();
 	animation_set_mode(ANIMATION_STATIC);
 
-	for (z = 0; z < ZONE_COUNT; z++) {
-		/* Store the new color as the original color */
-		original_colors[z].colors = temp.colors;
-
-		zone_data[z].colors.red = (temp.colors.red * global_brightness) / 100;
-		zone_data[z].colors.green = (temp.colors.green * global_brightness) / 100;
-		zone_data[z].colors.blue = (temp.colors.blue * global_brightness) / 100;
-
-		ret = fourzone_update_led(&zone_data[z], HPWMI_WRITE);
-		if (ret)
-			return ret;
+	/* Store the new color as the original color */
+	rs = render_state_write_begin();
+	for (z = 0; z < ZONE_COUNT; z++)
+		rs->colors[z] = temp.colors;
+	render_state_write_end();
+
+	ret = update_all_zones_with_original_colors();
+	/* Animated layers keep running over the new static colors */
+	animation_start();
+	if (!ret) {
+		/* Save state */
+		save_animation_state();
 	}
+	render_state_unlock();
 
-	/* Save state */
-	save_animation_state();
-
-	return count;
+	return ret ? ret : count;
 }
 
 static ssize_t mute_led_show(struct device *dev, struct device_attribute *attr,
@@ -317,8 +512,269 @@ static ssize_t mute_state_set(struct device *dev, struct device_attribute *attr,
 
 static DEVICE_ATTR(mute_state, 0664, mute_state_show, mute_state_set);
 
+static ssize_t resync_set(struct device *dev, struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	int ret;
+
+	/* Drop the shadow buffer and re-read the lighting state from BIOS */
+	ret = fourzone_shadow_resync();
+	if (ret)
+		return ret;
+
+	return count;
+}
+
+static DEVICE_ATTR(resync, 0220, NULL, resync_set);
+
+static ssize_t frame_stats_show(struct device *dev, struct device_attribute *attr,
+				char *buf)
+{
+	u64 committed, skipped, coalesced;
+
+	mutex_lock(&fourzone_lock);
+	committed = frames_committed;
+	skipped = frames_skipped;
+	coalesced = frames_coalesced;
+	mutex_unlock(&fourzone_lock);
+
+	return sprintf(buf, "committed: %llu\nskipped: %llu\ncoalesced: %llu\n",
+		       committed, skipped, coalesced);
+}
+
+static DEVICE_ATTR(frame_stats, 0444, frame_stats_show, NULL);
+
+static ssize_t gamma_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	enum fourzone_gamma_mode mode;
+	u32 g;
+
+	mutex_lock(&fourzone_lock);
+	mode = fourzone_gamma_mode;
+	g = fourzone_gamma_q16;
+	mutex_unlock(&fourzone_lock);
+
+	switch (mode) {
+	case FOURZONE_GAMMA_SRGB:
+		return sprintf(buf, "srgb\n");
+	case FOURZONE_GAMMA_POWER:
+		/* Exponent with two decimals */
+		g = (g * 100 + (CF_Q16_ONE >> 1)) >> 16;
+		return sprintf(buf, "%u.%02u\n", g / 100, g % 100);
+	default:
+		return sprintf(buf, "linear\n");
+	}
+}
+
+/* Parse "N", "N.N" or "N.NN" into a Q16 exponent */
+static int parse_gamma(const char *buf, u32 *g)
+{
+	unsigned int whole = 0, frac = 0, scale = 1;
+	const char *p = buf;
+
+	if (!isdigit(*p))
+		return -EINVAL;
+	while (isdigit(*p))
+		whole = whole * 10 + (*p++ - '0');
+	if (*p == '.') {
+		p++;
+		while (isdigit(*p) && scale < 100) {
+			frac = frac * 10 + (*p++ - '0');
+			scale *= 10;
+		}
+	}
+	if (*p && *p != '\n')
+		return -EINVAL;
+	if (whole > 5)
+		return -EINVAL;
+
+	*g = whole * CF_Q16_ONE + frac * CF_Q16_ONE / scale;
+	return 0;
+}
+
+static ssize_t gamma_set(struct device *dev, struct device_attribute *attr,
+			 const char *buf, size_t count)
+{
+	enum fourzone_gamma_mode mode;
+	struct render_state rs;
+	u32 g = CF_Q16_ONE;
+	int ret = 0;
+
+	if (sysfs_streq(buf, "linear")) {
+		mode = FOURZONE_GAMMA_LINEAR;
+	} else if (sysfs_streq(buf, "srgb")) {
+		mode = FOURZONE_GAMMA_SRGB;
+	} else {
+		ret = parse_gamma(buf, &g);
+		if (ret)
+			return ret;
+		/* 0.10 to 5.00 */
+		if (g < CF_Q16_ONE / 10 || g > 5 * CF_Q16_ONE)
+			return -EINVAL;
+		mode = FOURZONE_GAMMA_POWER;
+	}
+
+	render_state_lock();
+	render_state_read(&rs);
+
+	mutex_lock(&fourzone_lock);
+	fourzone_gamma_mode = mode;
+	fourzone_gamma_q16 = g;
+	fourzone_out_lut_build(rs.brightness);
+	mutex_unlock(&fourzone_lock);
+
+	/* Static lighting is re-sent; animations pick it up on the next frame */
+	if (!rs.active)
+		ret = update_all_zones_with_original_colors();
+	render_state_unlock();
+
+	return ret ? ret : count;
+}
+
+static DEVICE_ATTR(gamma, 0664, gamma_show, gamma_set);
+
+/*
+ * Theme transaction: zone colors, brightness, mode and speed in one
+ * write, e.g. "zone00=ff0000 zone01=00ff00 brightness=80 mode=static".
+ * Everything is validated before anything changes, then applied with
+ * one BIOS commit and one state save. Keys left out keep their value.
+ */
+static ssize_t staged_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct render_state rs;
+	int len = 0;
+
+	render_state_read(&rs);
+	for (int zone = 0; zone < ZONE_COUNT; zone++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "zone%02X=%02x%02x%02x ",
+				 zone, rs.colors[zone].red, rs.colors[zone].green,
+				 rs.colors[zone].blue);
+	len += scnprintf(buf + len, PAGE_SIZE - len, "brightness=%d mode=%s speed=%d\n",
+			 rs.brightness, animation_mode_name(rs.mode), rs.speed);
+	return len;
+}
+
+static ssize_t staged_set(struct device *dev, struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	struct color_platform colors[ZONE_COUNT];
+	int brightness = -1, mode = -1, speed = -1;
+	struct platform_zone temp;
+	unsigned int zones = 0;
+	char local_buf[256];
+	char *p, *tok;
+	int ret = 0;
+	u8 zone;
+
+	if (count >= sizeof(local_buf))
+		return -EINVAL;
+	strscpy(local_buf, buf, count + 1);
+
+	p = local_buf;
+	while ((tok = strsep(&p, " \t\n")) != NULL) {
+		char *val = tok;
+		char *key;
+
+		if (*tok == '\0')
+			continue;
+
+		key = strsep(&val, "=");
+		if (!val)
+			return -EINVAL;
+
+		if (!strcmp(key, "all")) {
+			ret = parse_rgb(val, &temp);
+			if (ret)
+				return ret;
+			for (zone = 0; zone < ZONE_COUNT; zone++)
+				colors[zone] = temp.colors;
+			zones = BIT(ZONE_COUNT) - 1;
+		} else if (!strncmp(key, "zone", 4)) {
+			if (kstrtou8(key + 4, 16, &zone) || zone >= ZONE_COUNT)
+				return -EINVAL;
+			ret = parse_rgb(val, &temp);
+			if (ret)
+				return ret;
+			colors[zone] = temp.colors;
+			zones |= BIT(zone);
+		} else if (!strcmp(key, "brightness")) {
+			if (kstrtoint(val, 10, &brightness) ||
+			    brightness < 0 || brightness > 100)
+				return -EINVAL;
+		} else if (!strcmp(key, "mode")) {
+			mode = animation_mode_parse(val);
+			if (mode < 0)
+				return mode;
+		} else if (!strcmp(key, "speed")) {
+			if (kstrtoint(val, 10, &speed) ||
+			    speed < ANIMATION_SPEED_MIN || speed > ANIMATION_SPEED_MAX)
+				return -EINVAL;
+		} else {
+			return -EINVAL;
+		}
+	}
+
+	ret = fourzone_apply_theme(colors, zones, brightness, mode, speed);
+	return ret ? ret : count;
+}
+
+static DEVICE_ATTR(staged, 0664, staged_show, staged_set);
+
+int fourzone_apply_theme(const struct color_platform colors[ZONE_COUNT],
+			 unsigned int zones, int brightness, int mode, int speed)
+{
+	struct color_platform from[ZONE_COUNT];
+	struct render_state *rs;
+	bool mode_change;
+	int ret = 0;
+	u8 zone;
+
+	render_state_lock();
+	mode_change = mode >= 0 && mode != animation_get_mode();
+	if (mode_change)
+		fourzone_shown_frame(from);
+
+	/* One write section: no frame mixes old and new theme values */
+	rs = render_state_write_begin();
+	for (zone = 0; zone < ZONE_COUNT; zone++) {
+		if (zones & BIT(zone))
+			rs->colors[zone] = colors[zone];
+	}
+	if (brightness >= 0)
+		rs->brightness = brightness;
+	if (speed > 0)
+		animation_rebase_speed(rs, speed);
+	if (mode_change)
+		animation_fade_to(rs, mode, from);
+	render_state_write_end();
+
+	if (brightness >= 0) {
+		mutex_lock(&fourzone_lock);
+		fourzone_out_lut_build(brightness);
+		mutex_unlock(&fourzone_lock);
+	}
+
+	/*
+	 * A mode change crossfades; otherwise a running effect keeps going
+	 * and shows the new values with its next frame.
+	 */
+	if (mode_change)
+		animation_update();
+	else if (!animation_running())
+		ret = update_all_zones_with_original_colors();
+
+	if (!ret)
+		save_animation_state();
+	render_state_unlock();
+
+	return ret;
+}
+
 int fourzone_setup(struct platform_device *dev)
 {
+	struct render_state rs, *wrs;
 	u8 zone;
 	char buffer[10];
 	char *name;
@@ -329,7 +785,7 @@ int fourzone_setup(struct platform_device *dev)
 	if (!zone_dev_attrs)
 		return -ENOMEM;
 
-	zone_attrs = kcalloc(ZONE_COUNT + 8, sizeof(struct attribute *),
+	zone_attrs = kcalloc(ZONE_COUNT + 18, sizeof(struct attribute *),
 			     GFP_KERNEL);
 	if (!zone_attrs) {
 		ret = -ENOMEM;
@@ -343,18 +799,31 @@ int fourzone_setup(struct platform_device *dev)
 		goto err_free_zone_attrs;
 	}
 
+	/* Not fatal: without a context queries use ACPI_ALLOCATE_BUFFER */
+	fourzone_ctx = hp_wmi_ctx_alloc(FOURZONE_STATE_SIZE, HPWMI_PRIO_LIGHTING);
+	if (!fourzone_ctx)
+		pr_warn("no preallocated WMI context for lighting\n");
+
+	render_state_read(&rs);
+	mutex_lock(&fourzone_lock);
+	fourzone_out_lut_build(rs.brightness);
+	mutex_unlock(&fourzone_lock);
+
 	for (u8 zone = 0; zone < ZONE_COUNT; zone++) {
 		zone_data[zone].offset = 25 + (zone * 3);
-		ret = fourzone_update_led(&zone_data[zone], HPWMI_READ);
+		ret = fourzone_read_zone(&zone_data[zone]);
 		if (ret)
 			goto err_free_zone_data;
-
-		/* Store original colors */
-		original_colors[zone].colors.red = zone_data[zone].colors.red;
-		original_colors[zone].colors.green = zone_data[zone].colors.green;
-		original_colors[zone].colors.blue = zone_data[zone].colors.blue;
 	}
 
+	/* Store original colors */
+	render_state_lock();
+	wrs = render_state_write_begin();
+	for (zone = 0; zone < ZONE_COUNT; zone++)
+		wrs->colors[zone] = zone_data[zone].colors;
+	render_state_write_end();
+	render_state_unlock();
+
 	for (zone = 0; zone < ZONE_COUNT; zone++) {
 		sprintf(buffer, "zone%02hhX", zone);
 		name = kstrdup(buffer, GFP_KERNEL);
@@ -386,9 +855,20 @@ int fourzone_setup(struct platform_device *dev)
 	zone_attrs[ZONE_COUNT + 4] = &gradient_config_attr.attr;
 	zone_attrs[ZONE_COUNT + 5] = &dev_attr_mute_led.attr;
 	zone_attrs[ZONE_COUNT + 6] = &dev_attr_mute_state.attr;
-	zone_attrs[ZONE_COUNT + 7] = NULL; /* NULL terminate the array */
+	zone_attrs[ZONE_COUNT + 7] = &dev_attr_resync.attr;
+	zone_attrs[ZONE_COUNT + 8] = &dev_attr_frame_stats.attr;
+	zone_attrs[ZONE_COUNT + 9] = &animation_fps_attr.attr;
+	zone_attrs[ZONE_COUNT + 10] = &render_stats_attr.attr;
+	zone_attrs[ZONE_COUNT + 11] = &animation_fps_current_attr.attr;
+	zone_attrs[ZONE_COUNT + 12] = &dev_attr_gamma.attr;
+	zone_attrs[ZONE_COUNT + 13] = &dev_attr_staged.attr;
+	zone_attrs[ZONE_COUNT + 14] = &animation_layers_attr.attr;
+	zone_attrs[ZONE_COUNT + 15] = &animation_transition_attr.attr;
+	zone_attrs[ZONE_COUNT + 16] = &omen_profile_attr.attr;
+	zone_attrs[ZONE_COUNT + 17] = NULL; /* NULL terminate the array */
 
 	zone_attribute_group.attrs = zone_attrs;
+	zone_attribute_group.bin_attrs = zone_bin_attrs;
 
 	ret = sysfs_create_group(&dev->dev.kobj, &zone_attribute_group);
 	if (ret)
@@ -407,6 +887,8 @@ err_free_names:
 			kfree(zone_dev_attrs[z].attr.name);
 	}
 err_free_zone_data:
+	hp_wmi_ctx_free(fourzone_ctx);
+	fourzone_ctx = NULL;
 	kfree(zone_data);
 	zone_data = NULL;
 err_free_zone_attrs:
@@ -418,11 +900,17 @@ err_free_dev_attrs:
 	return ret;
 }
 
-void fourzone_cleanup(void)
+void fourzone_remove_sysfs(void)
 {
-	/* Remove sysfs group before freeing backing memory */
 	if (zone_platform_dev)
 		sysfs_remove_group(&zone_platform_dev->dev.kobj, &zone_attribute_group);
+	zone_platform_dev = NULL;
+}
+
+void fourzone_cleanup(void)
+{
+	/* Remove sysfs group before freeing backing memory */
+	fourzone_remove_sysfs();
 
 	/* Free allocated zone attribute names */
 	if (zone_dev_attrs) {
@@ -435,5 +923,10 @@ void fourzone_cleanup(void)
 	kfree(zone_dev_attrs);
 	kfree(zone_attrs);
 	kfree(zone_data);
+
+	mutex_lock(&fourzone_lock);
+	hp_wmi_ctx_free(fourzone_ctx);
+	fourzone_ctx = NULL;
+	mutex_unlock(&fourzone_lock);
 }
 
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-3
+/*
+ * HP OMEN RGB Keyboard Driver - Fixed-Point Color Math Test
+ *
+ * Checks src/utils/math/color_fixed.h against a double precision
+ * reference and reports the cost of each helper in ns per call.
+ *
+ * Build: cc -O2 -I../src/utils/math -o color-fixed-test color-fixed-test.c -lm
+ * Usage: color-fixed-test [iterations]
+ *
+ * Exits non-zero if any helper is outside its documented error bound.
+ *
+ * Author: alessandromrc
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "color_fixed.h"
+
+/* Error bound of the Q16 power and sRGB helpers, in Q16 units */
+#define POW_MAX_ERR	8
+
+static int failures;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned int round_ref(double x)
+{
+	return (unsigned int)floor(x + 0.5);
+}
+
+static void report(const char *name, unsigned long bad, unsigned long total)
+{
+	printf("%-18s %10lu inputs, %lu mismatches\n", name, total, bad);
+	if (bad)
+		failures++;
+}
+
+static void test_div255(void)
+{
+	unsigned long bad = 0;
+	u32 v;
+
+	for (v = 0; v <= 255 * 255; v++)
+		bad += cf_div255(v) != round_ref(v / 255.0);
+	report("cf_div255", bad, 255 * 255 + 1);
+}
+
+static void test_mul8(void)
+{
+	unsigned long bad = 0;
+	unsigned int a, b;
+
+	for (a = 0; a < 256; a++)
+		for (b = 0; b < 256; b++)
+			bad += cf_mul8(a, b) != round_ref(a * b / 255.0);
+	report("cf_mul8", bad, 256 * 256);
+}
+
+static void test_scale8(void)
+{
+	unsigned long bad = 0;
+	unsigned int c;
+	u32 f;
+
+	for (c = 0; c < 256; c++)
+		for (f = 0; f <= CF_Q16_ONE; f++)
+			bad += cf_scale8(c, f) != round_ref(c * (f / 65536.0));
+	report("cf_scale8", bad, 256UL * (CF_Q16_ONE + 1));
+}
+
+static void test_pct(void)
+{
+	unsigned long bad = 0;
+	unsigned int pct;
+
+	for (pct = 0; pct <= 100; pct++) {
+		bad += cf_pct_to_q16(pct) != round_ref(pct * 65536 / 100.0);
+		bad += cf_pct_to_u8(pct) != round_ref(pct * 255 / 100.0);
+	}
+	report("cf_pct_to_*", bad, 2 * 101);
+}
+
+static void test_lerp8(void)
+{
+	unsigned long bad = 0, total = 0;
+	unsigned int a, b, i;
+	u32 t;
+
+	/* Every 257th position, 0..65535, then 1.0 */
+	for (a = 0; a < 256; a++)
+		for (b = 0; b < 256; b++)
+			for (i = 0; i <= 256; i++) {
+				double ref;
+
+				t = i < 256 ? i * 257 : CF_Q16_ONE;
+				ref = a + ((double)b - a) * t / 65536.0;
+
+				bad += cf_lerp8(a, b, t) != round_ref(ref);
+				total++;
+			}
+	report("cf_lerp8", bad, total);
+}
+
+static void test_blend8(void)
+{
+	unsigned long bad = 0;
+	unsigned int dst, src, alpha;
+
+	for (dst = 0; dst < 256; dst++)
+		for (src = 0; src < 256; src++)
+			for (alpha = 0; alpha < 256; alpha++) {
+				double ref = (src * alpha + dst * (255.0 - alpha)) / 255.0;
+
+				bad += cf_blend8(dst, src, alpha) != round_ref(ref);
+			}
+	report("cf_blend8", bad, 256UL * 256 * 256);
+}
+
+static void test_hue_from_deg(void)
+{
+	unsigned long bad = 0;
+	unsigned int deg;
+
+	for (deg = 0; deg < 360; deg++)
+		bad += cf_hue_from_deg(deg) != (unsigned int)floor(deg * CF_HUE_MAX / 360.0);
+	report("cf_hue_from_deg", bad, 360);
+}
+
+static void hsv_ref(double h, double s, double v, double rgb[3])
+{
+	double f, p, q, t;
+	int sector;
+
+	h = fmod(h, 6.0);
+	sector = (int)h;
+	f = h - sector;
+	p = v * (1 - s);
+	q = v * (1 - s * f);
+	t = v * (1 - s * (1 - f));
+
+	switch (sector) {
+	case 0: rgb[0] = v; rgb[1] = t; rgb[2] = p; break;
+	case 1: rgb[0] = q; rgb[1] = v; rgb[2] = p; break;
+	case 2: rgb[0] = p; rgb[1] = v; rgb[2] = t; break;
+	case 3: rgb[0] = p; rgb[1] = q; rgb[2] = v; break;
+	case 4: rgb[0] = t; rgb[1] = p; rgb[2] = v; break;
+	default: rgb[0] = v; rgb[1] = p; rgb[2] = q; break;
+	}
+}
+
+/* Documented as within 1 on every channel, not exact */
+static void test_hsv_to_rgb(void)
+{
+	unsigned long bad = 0, exact = 0, total = 0;
+	unsigned int h, s, v, i;
+	double ref[3];
+	u8 out[3];
+
+	for (h = 0; h < CF_HUE_MAX; h++)
+		for (s = 0; s < 256; s++)
+			for (v = 0; v < 256; v++) {
+				int worst = 0;
+
+				cf_hsv_to_rgb(h, s, v, &out[0], &out[1], &out[2]);
+				hsv_ref((double)h / CF_HUE_SECTOR, s / 255.0, v / 255.0, ref);
+				for (i = 0; i < 3; i++) {
+					int d = abs((int)out[i] - (int)round_ref(ref[i] * 255));
+
+					if (d > worst)
+						worst = d;
+				}
+				bad += worst > 1;
+				exact += !worst;
+				total++;
+			}
+	report("cf_hsv_to_rgb", bad, total);
+	printf("%-18s %9.1f%% exact\n", "", 100.0 * exact / total);
+}
+
+static void test_pow(void)
+{
+	long err, worst_pow = 0, worst_srgb = 0;
+	u32 x, g;
+
+	for (g = CF_Q16_ONE / 4; g <= 4 * CF_Q16_ONE; g += CF_Q16_ONE / 4)
+		for (x = 1; x <= CF_Q16_ONE; x += 7) {
+			double ref = pow(x / 65536.0, g / 65536.0) * 65536;
+
+			err = labs((long)cf_pow_q16(x, g) - (long)round_ref(ref));
+			if (err > worst_pow)
+				worst_pow = err;
+		}
+
+	for (x = 0; x <= CF_Q16_ONE; x++) {
+		double e = x / 65536.0;
+		double ref = e <= 0.04045 ? e / 12.92 : pow((e + 0.055) / 1.055, 2.4);
+
+		err = labs((long)cf_srgb_decode_q16(x) - (long)round_ref(ref * 65536));
+		if (err > worst_srgb)
+			worst_srgb = err;
+	}
+
+	printf("%-18s max error %ld/65536\n", "cf_pow_q16", worst_pow);
+	printf("%-18s max error %ld/65536\n", "cf_srgb_decode_q16", worst_srgb);
+	if (worst_pow > POW_MAX_ERR || worst_srgb > POW_MAX_ERR)
+		failures++;
+}
+
+/* Keeps the compiler from dropping the timed calls */
+static volatile unsigned int sink;
+
+#define BENCH(name, iters, expr)					\
+	do {								\
+		unsigned int acc = 0;					\
+		double start = now_ns();				\
+		long n;							\
+									\
+		for (n = 0; n < (iters); n++)				\
+			acc += (expr);					\
+		sink = acc;						\
+		printf("%-18s %6.2f ns/op\n", name,			\
+		       (now_ns() - start) / (iters));			\
+	} while (0)
+
+static unsigned int hsv_packed(long n)
+{
+	u8 r, g, b;
+
+	cf_hsv_to_rgb(n % CF_HUE_MAX, n >> 3, n >> 5, &r, &g, &b);
+	return r + g + b;
+}
+
+static unsigned int hsv_float(long n)
+{
+	double rgb[3];
+
+	hsv_ref((double)(n % CF_HUE_MAX) / CF_HUE_SECTOR, (u8)(n >> 3) / 255.0,
+		(u8)(n >> 5) / 255.0, rgb);
+	return round_ref(rgb[0] * 255) + round_ref(rgb[1] * 255) +
+	       round_ref(rgb[2] * 255);
+}
+
+static void bench(long iters)
+{
+	/* Operands depend on the loop counter so nothing is hoisted */
+	BENCH("cf_div255", iters, cf_div255(n & 0xffff));
+	BENCH("cf_scale8", iters, cf_scale8(n, n & 0xffff));
+	BENCH("cf_lerp8", iters, cf_lerp8(n, n >> 8, n & 0xffff));
+	BENCH("cf_blend8", iters, cf_blend8(n, n >> 8, n >> 16));
+	BENCH("cf_hsv_to_rgb", iters, hsv_packed(n));
+	BENCH("float hsv_to_rgb", iters, hsv_float(n));
+	BENCH("cf_pow_q16", iters / 16, cf_pow_q16((n & 0xffff) + 1, 2 * CF_Q16_ONE));
+	BENCH("cf_srgb_decode_q16", iters / 16, cf_srgb_decode_q16(n & 0xffff));
+}
+
+int main(int argc, char **argv)
+{
+	long iters = argc > 1 ? atol(argv[1]) : 10000000;
+
+	if (iters < 16) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 2;
+	}
+
+	test_div255();
+	test_mul8();
+	test_scale8();
+	test_pct();
+	test_lerp8();
+	test_blend8();
+	test_hue_from_deg();
+	test_hsv_to_rgb();
+	test_pow();
+
+	bench(iters);
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
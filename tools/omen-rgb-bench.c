@@ -0,0 +1,383 @@
+// SPDX-License-Identifier: GPL-3
+/*
+ * HP OMEN RGB Keyboard Driver - Frame Path Benchmark
+ *
+ * Pushes color frames through the rgb_zones sysfs attributes or through
+ * /dev/omen-rgb and reports the achieved frame rate and commit latency.
+ * The theme path switches full themes (zone colors, brightness, mode and
+ * speed) one attribute at a time and through the staged attribute.
+ *
+ * The sysfs and ring paths also count slab allocations (kmem:kmalloc and
+ * kmem:kmem_cache_alloc tracepoints, all CPUs) over the run and over an
+ * idle window of the same length, and report the difference per frame.
+ * Needs root and tracefs; skipped otherwise.
+ *
+ * Build: cc -O2 -I../src/include -o omen-rgb-bench omen-rgb-bench.c
+ * Usage: omen-rgb-bench sysfs|ring|theme [frames]
+ *
+ * Author: alessandromrc
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uapi/omen_rgb.h"
+
+#define SYSFS_ZONES "/sys/devices/platform/omen-rgb-keyboard/rgb_zones"
+#define STREAM_DEV "/dev/omen-rgb"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* One counter per slab tracepoint and CPU */
+#define SLAB_MAX_FDS 1024
+
+static const char * const slab_events[] = { "kmalloc", "kmem_cache_alloc" };
+static int slab_fd[SLAB_MAX_FDS];
+static int slab_nfd;
+
+static int slab_event_id(const char *event)
+{
+	static const char * const roots[] = {
+		"/sys/kernel/tracing", "/sys/kernel/debug/tracing"
+	};
+	char path[128];
+	unsigned int i;
+	FILE *f;
+	int id;
+
+	for (i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+		snprintf(path, sizeof(path), "%s/events/kmem/%s/id", roots[i], event);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fscanf(f, "%d", &id) != 1)
+			id = -1;
+		fclose(f);
+		return id;
+	}
+	return -1;
+}
+
+/* Count the slab tracepoints system-wide; returns 0 if not permitted */
+static int slab_open(void)
+{
+	struct perf_event_attr attr;
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	unsigned int e;
+	long cpu;
+	int id;
+
+	for (e = 0; e < sizeof(slab_events) / sizeof(slab_events[0]); e++) {
+		id = slab_event_id(slab_events[e]);
+		if (id < 0)
+			goto fail;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_TRACEPOINT;
+		attr.size = sizeof(attr);
+		attr.config = id;
+
+		for (cpu = 0; cpu < cpus && slab_nfd < SLAB_MAX_FDS; cpu++) {
+			int fd = syscall(SYS_perf_event_open, &attr, -1, (int)cpu, -1, 0);
+
+			/* Offline CPUs cannot be counted and allocate nothing */
+			if (fd < 0 && errno == ENODEV)
+				continue;
+			if (fd < 0)
+				goto fail;
+			slab_fd[slab_nfd++] = fd;
+		}
+	}
+	return 1;
+
+fail:
+	fprintf(stderr, "slab counting unavailable (needs root and tracefs)\n");
+	while (slab_nfd)
+		close(slab_fd[--slab_nfd]);
+	return 0;
+}
+
+static unsigned long long slab_count(void)
+{
+	unsigned long long sum = 0, v;
+	int i;
+
+	for (i = 0; i < slab_nfd; i++) {
+		if (read(slab_fd[i], &v, sizeof(v)) == sizeof(v))
+			sum += v;
+	}
+	return sum;
+}
+
+/* Allocations of a run of @us minus those of an idle window as long */
+static void slab_report(const char *path, int frames, unsigned long long allocs,
+			double us)
+{
+	struct timespec ts = {
+		.tv_sec = (time_t)(us / 1e6),
+		.tv_nsec = (long)(us - (time_t)(us / 1e6) * 1e6) * 1000,
+	};
+	unsigned long long idle;
+	double per_frame;
+
+	if (!slab_nfd)
+		return;
+
+	idle = slab_count();
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+	idle = slab_count() - idle;
+
+	per_frame = ((double)allocs - (double)idle) / frames;
+	printf("%s: slab allocations %llu, idle baseline %llu, %.2f per frame\n",
+	       path, allocs, idle, per_frame > 0 ? per_frame : 0);
+}
+
+/* Same hue sweep for both paths */
+static void frame_color(int n, int zone, unsigned char rgb[3])
+{
+	int h = (n * 8 + zone * 64) % 768;
+
+	rgb[0] = h < 256 ? 255 - h : h < 512 ? 0 : h - 512;
+	rgb[1] = h < 256 ? h : h < 512 ? 511 - h : 0;
+	rgb[2] = h < 256 ? 0 : h < 512 ? h - 256 : 767 - h;
+}
+
+static int bench_sysfs(int frames)
+{
+	char path[128], buf[16];
+	unsigned char rgb[3];
+	int fd[OMEN_RGB_FRAME_ZONES];
+	double start, elapsed, worst = 0;
+	unsigned long long allocs;
+	int n, z;
+
+	for (z = 0; z < OMEN_RGB_FRAME_ZONES; z++) {
+		snprintf(path, sizeof(path), SYSFS_ZONES "/zone%02X", z);
+		fd[z] = open(path, O_WRONLY);
+		if (fd[z] < 0) {
+			perror(path);
+			return 1;
+		}
+	}
+
+	allocs = slab_count();
+	start = now_us();
+	for (n = 0; n < frames; n++) {
+		double t = now_us();
+
+		for (z = 0; z < OMEN_RGB_FRAME_ZONES; z++) {
+			frame_color(n, z, rgb);
+			snprintf(buf, sizeof(buf), "%02x%02x%02x", rgb[0], rgb[1], rgb[2]);
+			if (pwrite(fd[z], buf, strlen(buf), 0) < 0) {
+				perror("write");
+				return 1;
+			}
+		}
+
+		t = now_us() - t;
+		if (t > worst)
+			worst = t;
+	}
+
+	elapsed = now_us() - start;
+	allocs = slab_count() - allocs;
+
+	printf("sysfs: %d frames, %.1f fps, worst frame %.0f us\n", frames,
+	       frames * 1e6 / elapsed, worst);
+	slab_report("sysfs", frames, allocs, elapsed);
+	return 0;
+}
+
+static int write_attr(int fd, const char *buf)
+{
+	if (pwrite(fd, buf, strlen(buf), 0) < 0) {
+		perror("write");
+		return -1;
+	}
+	return 0;
+}
+
+/* Theme attributes written one by one, in the order a script would */
+enum { THEME_ZONE0, THEME_BRIGHTNESS = OMEN_RGB_FRAME_ZONES, THEME_MODE,
+       THEME_SPEED, THEME_STAGED, THEME_FDS };
+
+static const char * const theme_attrs[THEME_FDS - OMEN_RGB_FRAME_ZONES] = {
+	"brightness", "animation_mode", "animation_speed", "staged"
+};
+
+/* Two alternating static themes so every switch changes every value */
+static int theme_switch(const int *fd, int n, int staged)
+{
+	char buf[256], color[8];
+	unsigned char rgb[3];
+	int brightness = n & 1 ? 60 : 100;
+	int speed = n & 1 ? 2 : 1;
+	int len = 0, z;
+
+	for (z = 0; z < OMEN_RGB_FRAME_ZONES; z++) {
+		frame_color(n * 32, z, rgb);
+		snprintf(color, sizeof(color), "%02x%02x%02x", rgb[0], rgb[1], rgb[2]);
+		if (staged)
+			len += snprintf(buf + len, sizeof(buf) - len, "zone%02X=%s ", z, color);
+		else if (write_attr(fd[THEME_ZONE0 + z], color))
+			return -1;
+	}
+
+	if (staged) {
+		snprintf(buf + len, sizeof(buf) - len,
+			 "brightness=%d mode=static speed=%d", brightness, speed);
+		return write_attr(fd[THEME_STAGED], buf);
+	}
+
+	snprintf(buf, sizeof(buf), "%d", brightness);
+	if (write_attr(fd[THEME_BRIGHTNESS], buf) ||
+	    write_attr(fd[THEME_MODE], "static"))
+		return -1;
+	snprintf(buf, sizeof(buf), "%d", speed);
+	return write_attr(fd[THEME_SPEED], buf);
+}
+
+static int bench_theme(int themes)
+{
+	static const char * const name[2] = { "per-attribute", "staged" };
+	double start, t, worst, avg[2];
+	char path[128];
+	int fd[THEME_FDS];
+	int n, i, staged;
+
+	for (i = 0; i < THEME_FDS; i++) {
+		if (i < OMEN_RGB_FRAME_ZONES)
+			snprintf(path, sizeof(path), SYSFS_ZONES "/zone%02X", i);
+		else
+			snprintf(path, sizeof(path), SYSFS_ZONES "/%s",
+				 theme_attrs[i - OMEN_RGB_FRAME_ZONES]);
+		fd[i] = open(path, O_WRONLY);
+		if (fd[i] < 0) {
+			perror(path);
+			return 1;
+		}
+	}
+
+	for (staged = 0; staged < 2; staged++) {
+		worst = 0;
+		start = now_us();
+		for (n = 0; n < themes; n++) {
+			t = now_us();
+			if (theme_switch(fd, n, staged))
+				return 1;
+			t = now_us() - t;
+			if (t > worst)
+				worst = t;
+		}
+		avg[staged] = (now_us() - start) / themes;
+		printf("theme %s: %d switches, avg %.0f us, worst %.0f us\n",
+		       name[staged], themes, avg[staged], worst);
+	}
+
+	printf("theme: staged is %.1fx faster\n", avg[0] / avg[1]);
+
+	for (i = 0; i < THEME_FDS; i++)
+		close(fd[i]);
+	return 0;
+}
+
+static int bench_ring(int frames)
+{
+	struct omen_rgb_ring *ring;
+	double start, elapsed, t, lat = 0, worst = 0;
+	unsigned long long allocs;
+	int fd, n, z;
+	__u32 head;
+
+	fd = open(STREAM_DEV, O_RDWR);
+	if (fd < 0) {
+		perror(STREAM_DEV);
+		return 1;
+	}
+
+	ring = mmap(NULL, OMEN_RGB_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	if (ring->version != OMEN_RGB_RING_VERSION) {
+		fprintf(stderr, "ring version %u, expected %u\n", ring->version,
+			OMEN_RGB_RING_VERSION);
+		return 1;
+	}
+
+	allocs = slab_count();
+	start = now_us();
+	for (n = 0; n < frames; n++) {
+		head = ring->head;
+		for (z = 0; z < OMEN_RGB_FRAME_ZONES; z++)
+			frame_color(n, z, ring->frames[head % ring->slots].rgb[z]);
+		__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+		t = now_us();
+		if (ioctl(fd, OMEN_RGB_IOC_KICK) < 0) {
+			perror("ioctl");
+			return 1;
+		}
+
+		/* Wait for the commit to measure end-to-end latency */
+		while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != head + 1)
+			usleep(50);
+
+		t = now_us() - t;
+		lat += t;
+		if (t > worst)
+			worst = t;
+	}
+
+	elapsed = now_us() - start;
+	allocs = slab_count() - allocs;
+
+	printf("ring: %d frames, %.1f fps, commit latency avg %.0f us, worst %.0f us, skipped %u\n",
+	       frames, frames * 1e6 / elapsed, lat / frames, worst,
+	       ring->skipped);
+	slab_report("ring", frames, allocs, elapsed);
+
+	munmap(ring, OMEN_RGB_RING_SIZE);
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int frames = argc > 2 ? atoi(argv[2]) : 600;
+
+	if (argc < 2 || frames <= 0) {
+		fprintf(stderr, "usage: %s sysfs|ring|theme [frames]\n", argv[0]);
+		return 2;
+	}
+
+	if (strcmp(argv[1], "theme"))
+		slab_open();
+
+	if (!strcmp(argv[1], "sysfs"))
+		return bench_sysfs(frames);
+	if (!strcmp(argv[1], "ring"))
+		return bench_ring(frames);
+	if (!strcmp(argv[1], "theme"))
+		return bench_theme(frames);
+
+	fprintf(stderr, "unknown path '%s'\n", argv[1]);
+	return 2;
+}